@@ -1,8 +1,24 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "glob.h"
 
+#include "TFile.h"
+#include "TROOT.h"
+#include "TChain.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "MJTRun.hh"
+#include "MJTChannelMap.hh"
+#include "MJTChannelSettings.hh"
 #include "GATDataSet.hh"
 
 using namespace std;
@@ -32,16 +48,29 @@ using namespace std;
 // LoadEnrNatMap - quick way to tell if a given detID is enriched (1) or natural (0).
 // CheckModule - Given a detector ID, look up which module it lives in.
 // GetVetoActiveMass - Modifies total mass to not include veto-only detectors.
-// GetENFC - Parameters for corrected trapENFCal
-// GetENMC - Parameters for corrected trapENMCal
-// GetAvsE - AvsE parameters
-// GetDCR* - DCR parameters
+// CalParTable - Cached, channel-indexed copy of a Load*Pars table.
+// GetENFC - Parameters for corrected trapENFCal (table: LoadENFCPars)
+// GetENMC - Parameters for corrected trapENMCal (table: LoadENMCPars)
+// GetAvsE - AvsE parameters (table: LoadAvsEPars)
+// GetDCR* - DCR parameters (tables: LoadDCR*Pars)
+// RunCalibration - All of the above for one run, computed together for each hit,
+//                  or column-wise for a block of hits (HitColumns).
 // LoadDS4MuonList - Static muon list for DS-4, calculated manually
 //                   by $GATDIR/mjd-veto/skim-veto.cc
+// MuonIndex - Sorted muon list with binary-search "last muon before t" lookups.
 // GetLNRunCoverage - Given a run and DS number, verify that this run is covered
 //                    by the most recent LN Fill Tag.
 // LoadLNFillTimes1 - Returns a vector of M1 LN fills.
 // LoadLNFillTimes2 - Returns a vector of M2 LN fills.
+// LNFillVeto - Merged LN fill veto windows, for tagging events and LN deadtime.
+// RunMetadata - Run boundaries, start/stop times, and channel info from a built file.
+// GetRunMetaCachePath - Location of the run metadata cache for a DS.
+// RunMetaCache - On-disk cache of RunMetadata, so built files are only opened once.
+// ChannelSlots - Dense channel table (pulser monitors, cryostat 0, hit index) for the skimmer.
+// PulserCardTimes - Last pulser time on each digitizer card, for dtPulserCard.
+// GlobFiles - Sorted list of the files matching a shell pattern (~ is expanded).
+// SkimShards - Index and TChain view of a per-run sharded skim (skim_mjd_data -s).
+// CompactWaves - Packed waveform columns (wave-skim -w), read back as spans over int samples.
 //
 // ======================================================================
 
@@ -864,9 +893,57 @@ void GetVetoActiveMass(map<int,double> actM4Det_g, map<int,bool> detIDIsVetoOnly
 }
 
 
-double GetENFC(int chan, int dsNum, double trapENF, int run)
+// Dense, channel-indexed copy of one of the parameter tables below.
+// The Load*Pars functions build the table for a (dsNum, run) as a map literal,
+// which is far too slow to do for every hit.  Each Get* function keeps one of these
+// and only rebuilds it when dsNum or run changes, so per-hit lookups are an array index.
+struct CalParTable
+{
+  int dsNum = -999, run = -999;
+  bool loaded = false;  // false if the dataset has no table
+  int chMin = 0;
+  size_t nPars = 0;
+  vector<double> pars;  // nPars values per channel slot
+  vector<char> hasChan;
+
+  bool Update(int ds, int r, bool (*loadPars)(map<int,vector<double>>&, int, int))
+  {
+    if (ds == dsNum && r == run) return loaded;
+    dsNum = ds;
+    run = r;
+    map<int,vector<double>> table;
+    loaded = loadPars(table, ds, r);
+    pars.clear();
+    hasChan.clear();
+    nPars = 0;
+    if (!loaded || table.empty()) return loaded;
+
+    // map keys are sorted, so the channel range is just the first and last key.
+    chMin = table.begin()->first;
+    int nChans = table.rbegin()->first - chMin + 1;
+    for (auto const& x : table) nPars = max(nPars, x.second.size());
+    pars.assign(nChans * nPars, 0);
+    hasChan.assign(nChans, 0);
+    for (auto const& x : table) {
+      int idx = x.first - chMin;
+      hasChan[idx] = 1;
+      copy(x.second.begin(), x.second.end(), pars.begin() + idx * nPars);
+    }
+    return loaded;
+  }
+
+  // Returns NULL if the channel isn't in the table.
+  const double* Find(int chan) const
+  {
+    int idx = chan - chMin;
+    if (idx < 0 || idx >= (int)hasChan.size() || !hasChan[idx]) return NULL;
+    return &pars[idx * nPars];
+  }
+};
+
+
+bool LoadENFCPars(map<int,vector<double>>& calPars, int dsNum, int run)
 {
-  map<int, vector<double> > calPars;
   if (dsNum == 0) {
     calPars = {
     {692, {0.0320538, 1.00002}},
@@ -1417,19 +1494,24 @@ double GetENFC(int chan, int dsNum, double trapENF, int run)
       };
     }
   }
-  else if (dsNum == 6) {
-    return trapENF;
-  }
-  else return 0;
-  if (calPars.find(chan) == calPars.end()) return 0.0;
-  double result = trapENF * calPars[chan][1] + calPars[chan][0];
-  return result;
+  else return false;
+  return true;
 }
 
 
-double GetENMC(int chan, int dsNum, double trapENM, int run)
+double GetENFC(int chan, int dsNum, double trapENF, int run)
+{
+  if (dsNum == 6) return trapENF;
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadENFCPars)) return 0;
+  const double *p = pars.Find(chan);
+  if (p == NULL) return 0.0;
+  return trapENF * p[1] + p[0];
+}
+
+
+bool LoadENMCPars(map<int,vector<double>>& calPars, int dsNum, int run)
 {
-  map<int, vector<double> > calPars;
   if (dsNum == 0) {
     calPars = {
     {692, {0.0725279, 0.999578}},
@@ -1981,20 +2063,24 @@ double GetENMC(int chan, int dsNum, double trapENM, int run)
     }
 
   }
-  else if (dsNum == 6) {
-    return trapENM;
-  }
-  else return 0;
-  if (calPars.find(chan) == calPars.end()) return 0.0;
-  double result = trapENM * calPars[chan][1] + calPars[chan][0];
-  return result;
+  else return false;
+  return true;
 }
 
 
-double GetAvsE(int chan, double TSCurrent50nsMax, double TSCurrent100nsMax, double TSCurrent200nsMax,
-  double trapENF, double trapENFCal, int dsNum, int run)
+double GetENMC(int chan, int dsNum, double trapENM, int run)
+{
+  if (dsNum == 6) return trapENM;
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadENMCPars)) return 0;
+  const double *p = pars.Find(chan);
+  if (p == NULL) return 0.0;
+  return trapENM * p[1] + p[0];
+}
+
+
+bool LoadAvsEPars(map<int,vector<double>>& AvE, int dsNum, int run)
 {
-  map<int, vector<double> > AvE;
   if (dsNum == 0) {
     AvE = {
     {692, {100, -0.07529620352886, 0.00652477250763, -0.00000004229313, -0.0559368 }},
@@ -2474,25 +2560,32 @@ double GetAvsE(int chan, double TSCurrent50nsMax, double TSCurrent100nsMax, doub
     {1232, {100, -0.04590393329048, 0.00683399399740, -0.00000004166288, -0.0759763}},
     {1233, {100, -0.05718407620942, 0.00690221156734, -0.00000005313559, -0.0522841}}
     };
-  else {
-    // cout << "Error: GetAvsE(): Unknown dataset number: " << dsNum << endl;
-    return 0.0;
-  }
+  else return false;
+  return true;
+}
+
+
+double GetAvsE(int chan, double TSCurrent50nsMax, double TSCurrent100nsMax, double TSCurrent200nsMax,
+  double trapENF, double trapENFCal, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadAvsEPars)) return 0.0;
+
   // Apply the formula and return the value
-  if (AvE.find(chan) == AvE.end()) return 0.0; // not found
+  const double *p = pars.Find(chan);
+  if (p == NULL) return 0.0; // not found
   double tsCurrent=0, result=0.;
-  if      (AvE[chan][0] == 100) tsCurrent = TSCurrent100nsMax;
-  else if (AvE[chan][0] == 50)  tsCurrent = TSCurrent50nsMax;
-  else if (AvE[chan][0] == 200) tsCurrent = TSCurrent200nsMax;
-  result = -1 * ( (tsCurrent * trapENFCal / trapENF) - AvE[chan][1] - AvE[chan][2] * trapENFCal - AvE[chan][3] * pow(trapENFCal,2) ) / AvE[chan][4];
+  if      (p[0] == 100) tsCurrent = TSCurrent100nsMax;
+  else if (p[0] == 50)  tsCurrent = TSCurrent50nsMax;
+  else if (p[0] == 200) tsCurrent = TSCurrent200nsMax;
+  result = -1 * ( (tsCurrent * trapENFCal / trapENF) - p[1] - p[2] * trapENFCal - p[3] * pow(trapENFCal,2) ) / p[4];
   return result;
 }
 
 
-double GetDCR90(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR90Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
   // This cut is used to set other DCR cuts.
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { 2.62025e-05, -3.19821e-05, 0.000110951}},
@@ -3135,19 +3228,27 @@ double GetDCR90(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int r
     {1332, { 2.55849e-05, -2.75709e-05, 4.05597e-05}},
     {1333, { 9.32543e-06, -8.33993e-06, 1.75658e-05}},
   };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR90(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR90Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
-  else return nlcblrwfSlope - (DCR[chan][0] + trapMax * DCR[chan][1]) - DCR[chan][2];
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
+  else return nlcblrwfSlope - (p[0] + trapMax * p[1]) - p[2];
 }
 
 
-double GetDCRCTC90(int chan, double nlcblrwfSlope, double trapE, double trapMax, int dsNum)
+bool LoadDCRCTC90Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
   // DCR with charge trapping correction applied
-  map<int,vector<double>> DCR;
   if(dsNum == 3) DCR = {
     //params updated 26 Jan 2017, using updated DS 3 AvsE
     {578, { 1.127394E-04, -2.433297E-04, 6.153314E-05, -3.202111E-05, 1.150849E-04}},
@@ -3220,18 +3321,26 @@ double GetDCRCTC90(int chan, double nlcblrwfSlope, double trapE, double trapMax,
     {1332, { 1.720117E-04, -2.109293E-04, 7.220260E-05, -3.190263E-05, 1.329770E-04}},
     {1333, { 6.012840E-05, -1.833330E-04, 6.935094E-05, -9.671974E-06, 6.534142E-05}}
   };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCRCTC90(int chan, double nlcblrwfSlope, double trapE, double trapMax, int dsNum)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, 0, LoadDCRCTC90Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
-  else return nlcblrwfSlope-((DCR[chan][0]*exp(DCR[chan][1]*trapMax))*(trapE-trapMax))-(DCR[chan][2]+trapMax*DCR[chan][3])-DCR[chan][4];
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
+  else return nlcblrwfSlope-((p[0]*exp(p[1]*trapMax))*(trapE-trapMax))-(p[2]+trapMax*p[3])-p[4];
 }
 
 
-double GetDCR85(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR85Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { 2.39111e-05}},
@@ -3657,19 +3766,27 @@ double GetDCR85(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int r
     {1332, { 9.20321e-06}},
     {1333, { 3.8676e-06}},
   };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR85(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR85Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
-double GetDCR95(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR95Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { -3.98106e-05}},
@@ -4095,19 +4212,27 @@ double GetDCR95(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int r
     {1332, { -1.69828e-05}},
     {1333, { -5.946e-06}},
  };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR95(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR95Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
-double GetDCR98(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR98Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { -0.000108146}},
@@ -4533,19 +4658,27 @@ double GetDCR98(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int r
     {1332, { -4.01447e-05}},
     {1333, { -1.34976e-05}},
  };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR98(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR98Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
-double GetDCR99(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR99Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { -0.000191695}},
@@ -5186,19 +5319,27 @@ double GetDCR99(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int r
     {1332, { -6.15866e-05}},
     {1333, { -2.01792e-05}},
  };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR99(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR99Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
-double GetDCR995(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR995Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { -0.000336846}},
@@ -5618,19 +5759,27 @@ double GetDCR995(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int
     {1332, { -9.04815e-05}},
     {1333, { -2.72784e-05}},
   };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR995(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR995Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
-double GetDCR999(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+bool LoadDCR999Pars(map<int,vector<double>>& DCR, int dsNum, int run)
 {
-  map<int,vector<double>> DCR;
   if (dsNum == 0) {
     DCR = {
       {576, { -0.000765814}},
@@ -6050,16 +6199,282 @@ double GetDCR999(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int
     {1332, { -0.000206061}},
     {1333, { -5.6232e-05}},
   };
-  else return 0;
+  else return false;
+  return true;
+}
+
+
+double GetDCR999(int chan, double nlcblrwfSlope, double trapMax, int dsNum, int run)
+{
+  static thread_local CalParTable pars;
+  if (!pars.Update(dsNum, run, LoadDCR999Pars)) return 0;
 
   // Calculate DCR only if we have trapMax and an "isGood" detector.
+  const double *p = pars.Find(chan);
   if (trapMax == 0) return 0;
-  else if (DCR.find(chan) == DCR.end()) return nlcblrwfSlope/trapMax;
+  else if (p == NULL) return nlcblrwfSlope/trapMax;
   double dcr90val = GetDCR90(chan, nlcblrwfSlope, trapMax, dsNum, run);
-  return dcr90val + DCR[chan][0];
+  return dcr90val + p[0];
 }
 
 
+// Derived parameters for one hit, filled by RunCalibration::Compute.
+struct HitCalibration
+{
+  double trapENFCalC=0, trapENMCalC=0, avse=0, dcrctc90=0;
+  double dcr85=0, dcr90=0, dcr95=0, dcr98=0, dcr99=0, dcr995=0, dcr999=0;
+};
+
+
+// A block of hits (from one run) stored column-wise, for RunCalibration::ComputeColumns.
+// Fill the input columns, and the output columns are resized to match.
+// recal_skim fills one block per run of a skim file, to recompute its columns offline.
+struct HitColumns
+{
+  vector<int> channel;
+  vector<double> trapENF, trapENFCal, trapENMCal, tsCurrent50nsMax, tsCurrent100nsMax, tsCurrent200nsMax, nlcblrwfSlope;
+  vector<double> trapENFCalC, trapENMCalC, avse, dcrctc90, dcr85, dcr90, dcr95, dcr98, dcr99, dcr995, dcr999;
+  vector<int> slot; // scratch space
+
+  size_t Size() const { return channel.size(); }
+  void Clear()
+  {
+    for (auto v : {&trapENF, &trapENFCal, &trapENMCal, &tsCurrent50nsMax, &tsCurrent100nsMax, &tsCurrent200nsMax, &nlcblrwfSlope})
+      v->clear();
+    channel.clear();
+  }
+  void Push(int chan, double enf, double enfCal, double enmCal, double a50, double a100, double a200, double slope)
+  {
+    channel.push_back(chan);
+    trapENF.push_back(enf);
+    trapENFCal.push_back(enfCal);
+    trapENMCal.push_back(enmCal);
+    tsCurrent50nsMax.push_back(a50);
+    tsCurrent100nsMax.push_back(a100);
+    tsCurrent200nsMax.push_back(a200);
+    nlcblrwfSlope.push_back(slope);
+  }
+};
+
+
+// All of the Get* parameters for one (dsNum, run), resolved into channel-indexed
+// arrays (one array per coefficient).  Build it once per run with Load; Compute then
+// gives the same values as the individual Get* calls, for every parameter of a hit at once.
+struct RunCalibration
+{
+  enum { kDCR85, kDCR95, kDCR98, kDCR99, kDCR995, kDCR999, kNDCROffsets };
+
+  int dsNum = -999, run = -999;
+  int chMin = 0, nChans = 0;
+
+  // 'loaded' is false if the dataset has no table, 'ok' is false if the channel isn't in it.
+  bool enfcIdentity = false, enmcIdentity = false;
+  bool enfcLoaded = false, enmcLoaded = false, avseLoaded = false, dcr90Loaded = false, ctcLoaded = false;
+  bool offLoaded[kNDCROffsets] = {};
+  vector<char> enfcOK, enmcOK, avseOK, dcr90OK, ctcOK, offOK[kNDCROffsets];
+  vector<double> enfc0, enfc1, enmc0, enmc1;
+  vector<double> avseWin, avse1, avse2, avse3, avse4;
+  vector<double> dcr90_0, dcr90_1, dcr90_2;
+  vector<double> ctc0, ctc1, ctc2, ctc3, ctc4;
+  vector<double> off0[kNDCROffsets];
+
+  void Load(int ds, int r)
+  {
+    if (ds == dsNum && r == run) return;
+    dsNum = ds;
+    run = r;
+
+    map<int,vector<double>> enfc, enmc, avse, dcr90, ctc, off[kNDCROffsets];
+    bool (*offLoaders[kNDCROffsets])(map<int,vector<double>>&, int, int) = {
+      LoadDCR85Pars, LoadDCR95Pars, LoadDCR98Pars, LoadDCR99Pars, LoadDCR995Pars, LoadDCR999Pars
+    };
+    enfcIdentity = (ds == 6);
+    enmcIdentity = (ds == 6);
+    enfcLoaded = LoadENFCPars(enfc, ds, r);
+    enmcLoaded = LoadENMCPars(enmc, ds, r);
+    avseLoaded = LoadAvsEPars(avse, ds, r);
+    dcr90Loaded = LoadDCR90Pars(dcr90, ds, r);
+    ctcLoaded = LoadDCRCTC90Pars(ctc, ds, 0);
+    for (int i = 0; i < kNDCROffsets; i++) offLoaded[i] = offLoaders[i](off[i], ds, r);
+
+    // One channel range covering every table
+    int chMax = -1;
+    chMin = 0;
+    vector<map<int,vector<double>>*> tables = {&enfc, &enmc, &avse, &dcr90, &ctc};
+    for (int i = 0; i < kNDCROffsets; i++) tables.push_back(&off[i]);
+    for (auto t : tables) {
+      if (t->empty()) continue;
+      if (chMax < 0 || t->begin()->first < chMin) chMin = t->begin()->first;
+      chMax = max(chMax, t->rbegin()->first);
+    }
+    nChans = (chMax < 0) ? 0 : chMax - chMin + 1;
+
+    Resolve(enfc, enfcOK, {&enfc0, &enfc1});
+    Resolve(enmc, enmcOK, {&enmc0, &enmc1});
+    Resolve(avse, avseOK, {&avseWin, &avse1, &avse2, &avse3, &avse4});
+    Resolve(dcr90, dcr90OK, {&dcr90_0, &dcr90_1, &dcr90_2});
+    Resolve(ctc, ctcOK, {&ctc0, &ctc1, &ctc2, &ctc3, &ctc4});
+    for (int i = 0; i < kNDCROffsets; i++) Resolve(off[i], offOK[i], {&off0[i]});
+  }
+
+  // Copy a table into its coefficient columns.  Missing coefficients are left at 0.
+  // There is one extra, always-empty slot at the end for channels outside the range.
+  void Resolve(const map<int,vector<double>>& table, vector<char>& ok, vector<vector<double>*> cols)
+  {
+    ok.assign(nChans+1, 0);
+    for (auto c : cols) c->assign(nChans+1, 0);
+    for (auto const& x : table) {
+      int idx = x.first - chMin;
+      ok[idx] = 1;
+      for (size_t j = 0; j < cols.size() && j < x.second.size(); j++) (*cols[j])[idx] = x.second[j];
+    }
+  }
+
+  // Returns -1 if the channel is outside every table.
+  int Slot(int chan) const
+  {
+    int idx = chan - chMin;
+    return (idx < 0 || idx >= nChans) ? -1 : idx;
+  }
+
+  // Same argument conventions as skim_mjd_data: the DCR's use trapENMCal as trapMax,
+  // and dcrctc90 uses trapENFCal as trapE.
+  void Compute(int chan, double trapENF, double trapENFCal, double trapENMCal,
+    double a50, double a100, double a200, double nlcblrwfSlope, HitCalibration& hc) const
+  {
+    int i = Slot(chan);
+
+    // corrected energies
+    if (enfcIdentity) hc.trapENFCalC = trapENFCal;
+    else hc.trapENFCalC = (enfcLoaded && i >= 0 && enfcOK[i]) ? trapENFCal * enfc1[i] + enfc0[i] : 0;
+    if (enmcIdentity) hc.trapENMCalC = trapENMCal;
+    else hc.trapENMCalC = (enmcLoaded && i >= 0 && enmcOK[i]) ? trapENMCal * enmc1[i] + enmc0[i] : 0;
+
+    // avse
+    hc.avse = 0;
+    if (avseLoaded && i >= 0 && avseOK[i]) {
+      double tsCurrent = 0;
+      if      (avseWin[i] == 100) tsCurrent = a100;
+      else if (avseWin[i] == 50)  tsCurrent = a50;
+      else if (avseWin[i] == 200) tsCurrent = a200;
+      hc.avse = -1 * ( (tsCurrent * trapENFCal / trapENF) - avse1[i] - avse2[i] * trapENFCal - avse3[i] * pow(trapENFCal,2) ) / avse4[i];
+    }
+
+    // DCR's.  Calculate only if we have trapMax and an "isGood" detector.
+    double trapMax = trapENMCal;
+    double *offVals[kNDCROffsets] = {&hc.dcr85, &hc.dcr95, &hc.dcr98, &hc.dcr99, &hc.dcr995, &hc.dcr999};
+    hc.dcr90 = 0;
+    if (dcr90Loaded && trapMax != 0) {
+      if (i >= 0 && dcr90OK[i]) hc.dcr90 = nlcblrwfSlope - (dcr90_0[i] + trapMax * dcr90_1[i]) - dcr90_2[i];
+      else hc.dcr90 = nlcblrwfSlope/trapMax;
+    }
+    for (int j = 0; j < kNDCROffsets; j++) {
+      *offVals[j] = 0;
+      if (!offLoaded[j] || trapMax == 0) continue;
+      if (i >= 0 && offOK[j][i]) *offVals[j] = hc.dcr90 + off0[j][i];
+      else *offVals[j] = nlcblrwfSlope/trapMax;
+    }
+    hc.dcrctc90 = 0;
+    if (ctcLoaded && trapMax != 0) {
+      double trapE = trapENFCal;
+      if (i >= 0 && ctcOK[i])
+        hc.dcrctc90 = nlcblrwfSlope-((ctc0[i]*exp(ctc1[i]*trapMax))*(trapE-trapMax))-(ctc2[i]+trapMax*ctc3[i])-ctc4[i];
+      else hc.dcrctc90 = nlcblrwfSlope/trapMax;
+    }
+  }
+
+  // Column-wise Compute for a whole block of hits (e.g. a run of a skim file), giving identical results.
+  // Each loop is a gather from the coefficient arrays plus straight-line arithmetic,
+  // with the table/channel checks done as selects, so the compiler can vectorize them.
+  // The block is done in chunks that stay in cache between the loops.
+  void ComputeColumns(HitColumns& h) const
+  {
+    size_t n = h.Size();
+    for (auto v : {&h.trapENFCalC, &h.trapENMCalC, &h.avse, &h.dcrctc90, &h.dcr85, &h.dcr90,
+      &h.dcr95, &h.dcr98, &h.dcr99, &h.dcr995, &h.dcr999})
+      v->resize(n);
+    h.slot.resize(n);
+    const size_t kChunk = 256;
+    for (size_t lo = 0; lo < n; lo += kChunk) ComputeRange(h, lo, min(n, lo + kChunk));
+  }
+
+  // ComputeColumns for hits [lo, hi).  The output columns must already be sized.
+  void ComputeRange(HitColumns& h, size_t lo, size_t hi) const
+  {
+    const int *ch = h.channel.data();
+    const double *enf = h.trapENF.data(), *enfCal = h.trapENFCal.data(), *enmCal = h.trapENMCal.data();
+    const double *a50 = h.tsCurrent50nsMax.data(), *a100 = h.tsCurrent100nsMax.data(), *a200 = h.tsCurrent200nsMax.data();
+    const double *slope = h.nlcblrwfSlope.data();
+    int *slot = h.slot.data();
+
+    // channel -> slot, with out-of-range channels sent to the empty slot
+    for (size_t k = lo; k < hi; k++) {
+      int idx = ch[k] - chMin;
+      slot[k] = (idx >= 0 && idx < nChans) ? idx : nChans;
+    }
+
+    // corrected energies
+    double *enfcOut = h.trapENFCalC.data(), *enmcOut = h.trapENMCalC.data();
+    for (size_t k = lo; k < hi; k++) {
+      int s = slot[k];
+      double cal = enfCal[k] * enfc1[s] + enfc0[s];
+      enfcOut[k] = enfcIdentity ? enfCal[k] : (enfcOK[s] ? cal : 0);
+    }
+    for (size_t k = lo; k < hi; k++) {
+      int s = slot[k];
+      double cal = enmCal[k] * enmc1[s] + enmc0[s];
+      enmcOut[k] = enmcIdentity ? enmCal[k] : (enmcOK[s] ? cal : 0);
+    }
+
+    // avse
+    double *avseOut = h.avse.data();
+    for (size_t k = lo; k < hi; k++) {
+      int s = slot[k];
+      double win = avseWin[s];
+      double tsCurrent = (win == 100) ? a100[k] : (win == 50) ? a50[k] : (win == 200) ? a200[k] : 0;
+      double e = enfCal[k];
+      double val = -1 * ( (tsCurrent * e / enf[k]) - avse1[s] - avse2[s] * e - avse3[s] * pow(e,2) ) / avse4[s];
+      avseOut[k] = avseOK[s] ? val : 0;
+    }
+
+    // DCR's.  trapMax is trapENMCal.
+    double *dcr90Out = h.dcr90.data();
+    if (!dcr90Loaded) fill(dcr90Out+lo, dcr90Out+hi, 0);
+    else for (size_t k = lo; k < hi; k++) {
+      int s = slot[k];
+      double trapMax = enmCal[k];
+      double val = slope[k] - (dcr90_0[s] + trapMax * dcr90_1[s]) - dcr90_2[s];
+      double raw = slope[k]/trapMax;
+      dcr90Out[k] = (trapMax == 0) ? 0 : (dcr90OK[s] ? val : raw);
+    }
+    double *offOut[kNDCROffsets] = {h.dcr85.data(), h.dcr95.data(), h.dcr98.data(),
+      h.dcr99.data(), h.dcr995.data(), h.dcr999.data()};
+    for (int j = 0; j < kNDCROffsets; j++) {
+      const double *o = off0[j].data();
+      const char *ok = offOK[j].data();
+      double *out = offOut[j];
+      if (!offLoaded[j]) { fill(out+lo, out+hi, 0); continue; }
+      for (size_t k = lo; k < hi; k++) {
+        int s = slot[k];
+        double trapMax = enmCal[k];
+        double val = dcr90Out[k] + o[s];
+        double raw = slope[k]/trapMax;
+        out[k] = (trapMax == 0) ? 0 : (ok[s] ? val : raw);
+      }
+    }
+    double *ctcOut = h.dcrctc90.data();
+    if (!ctcLoaded) fill(ctcOut+lo, ctcOut+hi, 0);
+    else for (size_t k = lo; k < hi; k++) {
+      int s = slot[k];
+      double trapMax = enmCal[k], trapE = enfCal[k];
+      double val = slope[k]-((ctc0[s]*exp(ctc1[s]*trapMax))*(trapE-trapMax))-(ctc2[s]+trapMax*ctc3[s])-ctc4[s];
+      double raw = slope[k]/trapMax;
+      ctcOut[k] = (trapMax == 0) ? 0 : (ctcOK[s] ? val : raw);
+    }
+  }
+};
+
+
 bool GetLNRunCoverage(int dsNum, int run) {
   // Requested by Jason at the internal 0nbb review, 30 Aug. 2017.
   // Given a run and DS number, verify that this run is covered by the most recent LN Fill Tag.
@@ -6101,6 +6516,81 @@ void LoadDS4MuonList(vector<int> &muRuns, vector<double> &muRunTStarts,
 }
 
 
+// Muon list sorted run-major, time-minor, for "most recent muon before t" lookups.
+// It's never modified after Build, so queries are safe from several threads
+// and don't need events to arrive in time order.
+struct MuonIndex
+{
+  vector<int> runs, types;
+  vector<double> runTStarts, times, uncert;
+  vector<double> tEarliest; // time minus uncertainty (at least 10 ns)
+
+  void Build(const vector<int> &muRuns, const vector<double> &muRunTStarts,
+    const vector<double> &muTimes, const vector<int> &muTypes, const vector<double> &muUncert)
+  {
+    size_t n = muRuns.size();
+    vector<size_t> order(n);
+    vector<double> tE(n);
+    for (size_t i = 0; i < n; i++) {
+      order[i] = i;
+      tE[i] = muTimes[i] - max(1.e-8, muUncert[i]); // normally 10ns uncertainty
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (muRuns[a] != muRuns[b]) return muRuns[a] < muRuns[b];
+      return tE[a] < tE[b];
+    });
+    runs.resize(n); types.resize(n); runTStarts.resize(n);
+    times.resize(n); uncert.resize(n); tEarliest.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      size_t j = order[i];
+      runs[i] = muRuns[j];
+      types[i] = muTypes[j];
+      runTStarts[i] = muRunTStarts[j];
+      times[i] = muTimes[j];
+      uncert[i] = muUncert[j];
+      tEarliest[i] = tE[j];
+    }
+  }
+
+  size_t Size() const { return runs.size(); }
+
+  // Index of the last muon that could have come before clockTime in this run,
+  // or the last muon of an earlier run.  Returns 0 if there isn't one.
+  size_t FindLast(int run, double clockTime) const
+  {
+    size_t lo = 0, hi = runs.size(); // first entry that is after (run, clockTime)
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (runs[mid] < run || (runs[mid] == run && tEarliest[mid] <= clockTime)) lo = mid + 1;
+      else hi = mid;
+    }
+    return (lo == 0) ? 0 : lo - 1;
+  }
+
+  // Range [first, last) of the muons in one run.
+  pair<size_t,size_t> RunRange(int run) const
+  {
+    auto lo = lower_bound(runs.begin(), runs.end(), run);
+    auto hi = upper_bound(lo, runs.end(), run);
+    return make_pair(lo - runs.begin(), hi - runs.begin());
+  }
+
+  // Time (s) since muon i.  Without continuous running, the clock resets every run.
+  double DeltaT(size_t i, double t, double startTime, bool isCRMode) const
+  {
+    if (!isCRMode) return (startTime - runTStarts[i]) + (t - times[i]);
+    return t - times[i];
+  }
+
+  // Coincidence window.  DS-4 uses a larger window due to sync issues.
+  bool InWindow(size_t i, double dtmu, int dsNum) const
+  {
+    if (dsNum == 4) return (dtmu > -3.*(uncert[i]) && dtmu < (4. + uncert[i]));
+    return (dtmu > -1.*(uncert[i]) && dtmu < (1. + uncert[i]));
+  }
+};
+
+
 void LoadLNFillTimes1(vector<double>& lnFillTimes1, int dsNum)
 {
   if (dsNum == 0)
@@ -6222,3 +6712,664 @@ void LoadLNFillTimes2(vector<double>& lnFillTimes2, int dsNum)
       1489216551, 1489326545, 1489326846, 1489440424, 1489440725, 1489551743, 1489552044, 1489662244, 1489662545
     };
 }
+
+
+// Merged LN fill veto windows, [fill - 15 min, fill + 5 min] by default, sorted in time.
+// Used for both the skimmer's isLNFill tags and ds_livetime's LN fill deadtime.
+struct LNFillVeto
+{
+  vector<pair<double,double>> windows;
+
+  void Build(vector<double> fills, double before=900, double after=300)
+  {
+    windows.clear();
+    sort(fills.begin(), fills.end());
+    for (auto fill : fills) {
+      if (!windows.empty() && fill - before <= windows.back().second)
+        windows.back().second = max(windows.back().second, fill + after);
+      else
+        windows.push_back(make_pair(fill - before, fill + after));
+    }
+  }
+
+  // Is this (unix) time inside a veto window?
+  bool IsVetoed(double t) const
+  {
+    // first window that starts after t.  The one before it is the only candidate.
+    auto it = upper_bound(windows.begin(), windows.end(), t,
+      [](double val, const pair<double,double>& w) { return val < w.first; });
+    if (it == windows.begin()) return false;
+    --it;
+    return t <= it->second;
+  }
+
+  // Total vetoed time between start and stop.
+  double DeadTime(double start, double stop) const
+  {
+    // windows don't overlap, so their end times are sorted too.
+    auto it = lower_bound(windows.begin(), windows.end(), start,
+      [](const pair<double,double>& w, double val) { return w.second < val; });
+    double dead = 0;
+    for (; it != windows.end() && it->first <= stop; ++it)
+      dead += min(it->second, stop) - max(it->first, start);
+    return dead;
+  }
+};
+
+
+
+// Run metadata from the built file header (MJTRun, MJTChannelMap, MJTChannelSettings).
+// Everything the skimmer and ds_livetime need, so they don't have to reopen the built files.
+// The skimmer doesn't use the enabled channel list, so a built file without ChannelSettings
+// is still read (hasChSet = false); ds_livetime needs it.
+struct RunMetadata
+{
+  int run = -1;
+  long long builtSize = 0, builtMTime = 0; // the built file this was read from
+  bool hasChSet = false;
+  int startBoundary = -1, stopBoundary = -1;
+  double startClock = 0, stopClock = 0; // ns
+  time_t startUnix = 0, stopUnix = 0;
+  vector<uint32_t> enabledIDs, pulserChans;
+  map<int,string> detNames; // enabled channel -> kDetectorName
+  map<int,string> detPos;   // enabled channel -> detector position (GetDetectorPos)
+  map<int,int> chanCard;    // kIDHi/kIDLo channel -> 100*VME + card slot
+
+  bool IsCRMode() const {
+    return (startBoundary == MJTRun::kContinuousNoTSReset || stopBoundary == MJTRun::kContinuousNoTSReset);
+  }
+
+  bool ReadBuiltFile(string builtPath)
+  {
+    TDirectory* tdir = gROOT->CurrentDirectory();
+    TFile *bltFile = new TFile(builtPath.c_str(),"READ");
+    MJTRun *runInfo = (MJTRun*)bltFile->Get("run");
+    MJTChannelMap *chMap = (MJTChannelMap*)bltFile->Get("ChannelMap");
+    MJTChannelSettings *chSet = (MJTChannelSettings*)bltFile->Get("ChannelSettings");
+    if (runInfo==NULL || chMap==NULL) {
+      cout << "RunMetadata: Couldn't read the run info from " << builtPath << endl;
+      delete bltFile;
+      gROOT->cd(tdir->GetPath());
+      return false;
+    }
+    startBoundary = runInfo->GetStartRunBoundaryType();
+    stopBoundary = runInfo->GetStopRunBoundaryType();
+    startClock = runInfo->GetStartClockTime();
+    stopClock = runInfo->GetStopClockTime();
+    startUnix = runInfo->GetStartTime();
+    stopUnix = runInfo->GetStopTime();
+    pulserChans = chMap->GetPulserChanList();
+    hasChSet = (chSet != NULL);
+    enabledIDs.clear();
+    if (hasChSet) enabledIDs = chSet->GetEnabledIDList();
+    detNames.clear();
+    detPos.clear();
+    for (auto enab : enabledIDs) {
+      detNames[enab] = chMap->GetString(enab, "kDetectorName");
+      detPos[enab] = chMap->GetDetectorPos(enab);
+    }
+
+    chanCard.clear();
+    katrin::KTable chTable = chMap->GetTable();
+    vector<katrin::KVariant> chVMEVec = chTable.GetColumn("kVME");
+    vector<katrin::KVariant> chSlotVec = chTable.GetColumn("kCardSlot");
+    vector<katrin::KVariant> chIDHiVec = chTable.GetColumn("kIDHi");
+    vector<katrin::KVariant> chIDLoVec = chTable.GetColumn("kIDLo");
+    for (size_t i = 0; i < chSlotVec.size(); i++) {
+      int card = (int)chVMEVec[i].AsDouble()*100 + (int)chSlotVec[i].AsDouble();
+      chanCard[(int)chIDHiVec[i].AsDouble()] = card;
+      chanCard[(int)chIDLoVec[i].AsDouble()] = card;
+    }
+    delete bltFile;
+    gROOT->cd(tdir->GetPath());
+    return true;
+  }
+
+  // Size and modification time of a built file, or false if it can't be found.
+  static bool BuiltFileVersion(string builtPath, long long& size, long long& mtime)
+  {
+    struct stat st;
+    if (stat(builtPath.c_str(), &st) != 0) return false;
+    size = (long long)st.st_size;
+    mtime = (long long)st.st_mtime;
+    return true;
+  }
+};
+
+
+// Directory for the run metadata (and livetime) caches: $RUNMETADIR, or else $MJDDATADIR/LAT,
+// so every job finds the same cache wherever it's started from.  "" if neither is set.
+string GetRunMetaCacheDir()
+{
+  char const* tmpPath = getenv("RUNMETADIR");
+  if (tmpPath != NULL) return tmpPath;
+  tmpPath = getenv("MJDDATADIR");
+  if (tmpPath != NULL) return string(tmpPath) + "/LAT";
+  return "";
+}
+
+// Where the run metadata cache for a data set lives.  "" (don't cache) if there's no cache directory.
+string GetRunMetaCachePath(int dsNum)
+{
+  string dir = GetRunMetaCacheDir();
+  if (dir == "") {
+    cout << "Neither $RUNMETADIR nor $MJDDATADIR is set, so the run metadata isn't cached.\n";
+    return "";
+  }
+  return dir + "/runMetaDS" + to_string(dsNum) + ".bin";
+}
+
+
+// On-disk cache of RunMetadata, one small binary file per data set.
+// Get() reads a run's built file the first time the run is seen, and again if the built file's
+// size or modification time has changed since (if the built file is gone, the cached copy is used).
+// Save() merges with whatever is on disk now, so several jobs can share one file.
+struct RunMetaCache
+{
+  static const int kVersion = 3;
+  string path;
+  map<int,RunMetadata> runs;
+  bool dirty = false;
+
+  RunMetaCache(string cachePath="") : path(cachePath) {
+    if (path != "") Read(path, runs);
+  }
+
+  const RunMetadata* Get(int run)
+  {
+    GATDataSet ds;
+    string builtPath = ds.GetPathToRun(run,GATDataSet::kBuilt);
+    long long size = 0, mtime = 0;
+    bool found = RunMetadata::BuiltFileVersion(builtPath, size, mtime);
+    auto it = runs.find(run);
+    if (it != runs.end() && (!found || (it->second.builtSize == size && it->second.builtMTime == mtime)))
+      return &(it->second);
+    RunMetadata meta;
+    if (!meta.ReadBuiltFile(builtPath)) return NULL;
+    meta.run = run;
+    meta.builtSize = size;
+    meta.builtMTime = mtime;
+    dirty = true;
+    return &(runs[run] = meta);
+  }
+
+  bool Save()
+  {
+    if (path == "" || !dirty) return true;
+    map<int,RunMetadata> onDisk;
+    Read(path, onDisk);
+    for (auto& r : onDisk) runs.insert(r); // ours win if both have it
+
+    // write a temp file and rename it, so readers never see a partial file
+    size_t slash = path.find_last_of('/');
+    if (slash != string::npos) mkdir(path.substr(0, slash).c_str(), 0775); // fine if it's already there
+    string tmpPath = path + ".tmp" + to_string((int)getpid());
+    ofstream out(tmpPath.c_str(), ios::binary);
+    if (!out) { cout << "RunMetaCache: Couldn't write " << tmpPath << endl; return false; }
+    out.write("RMETA", 5);
+    WritePOD(out, (int)kVersion);
+    WritePOD(out, (int)runs.size());
+    for (auto& r : runs) {
+      const RunMetadata& m = r.second;
+      WritePOD(out, m.run);
+      WritePOD(out, m.builtSize); WritePOD(out, m.builtMTime);
+      WritePOD(out, m.hasChSet);
+      WritePOD(out, m.startBoundary); WritePOD(out, m.stopBoundary);
+      WritePOD(out, m.startClock); WritePOD(out, m.stopClock);
+      WritePOD(out, (long long)m.startUnix); WritePOD(out, (long long)m.stopUnix);
+      WriteVec(out, m.enabledIDs);
+      WriteVec(out, m.pulserChans);
+      WriteStrMap(out, m.detNames);
+      WriteStrMap(out, m.detPos);
+      WritePOD(out, (int)m.chanCard.size());
+      for (auto& c : m.chanCard) { WritePOD(out, c.first); WritePOD(out, c.second); }
+    }
+    out.close();
+    if (!out || rename(tmpPath.c_str(), path.c_str()) != 0) {
+      cout << "RunMetaCache: Couldn't save " << path << endl;
+      remove(tmpPath.c_str());
+      return false;
+    }
+    dirty = false;
+    return true;
+  }
+
+  static bool Read(string cachePath, map<int,RunMetadata>& out)
+  {
+    ifstream in(cachePath.c_str(), ios::binary);
+    if (!in) return false;
+    char magic[5];
+    int version=0, nRuns=0;
+    in.read(magic, 5);
+    ReadPOD(in, version);
+    if (!in || string(magic,5) != "RMETA" || version != kVersion) {
+      cout << "RunMetaCache: Ignoring " << cachePath << " (unknown format)\n";
+      return false;
+    }
+    ReadPOD(in, nRuns);
+    for (int i = 0; i < nRuns && in; i++) {
+      RunMetadata m;
+      long long t0=0, t1=0;
+      int n=0;
+      ReadPOD(in, m.run);
+      ReadPOD(in, m.builtSize); ReadPOD(in, m.builtMTime);
+      ReadPOD(in, m.hasChSet);
+      ReadPOD(in, m.startBoundary); ReadPOD(in, m.stopBoundary);
+      ReadPOD(in, m.startClock); ReadPOD(in, m.stopClock);
+      ReadPOD(in, t0); ReadPOD(in, t1);
+      m.startUnix = (time_t)t0, m.stopUnix = (time_t)t1;
+      ReadVec(in, m.enabledIDs);
+      ReadVec(in, m.pulserChans);
+      ReadStrMap(in, m.detNames);
+      ReadStrMap(in, m.detPos);
+      ReadPOD(in, n);
+      for (int j = 0; j < n && in; j++) {
+        int chan=0, card=0;
+        ReadPOD(in, chan); ReadPOD(in, card);
+        m.chanCard[chan] = card;
+      }
+      if (in) out[m.run] = m;
+    }
+    return true;
+  }
+
+  template<typename T> static void WritePOD(ofstream& out, const T& val) { out.write((const char*)&val, sizeof(T)); }
+  template<typename T> static void ReadPOD(ifstream& in, T& val) { in.read((char*)&val, sizeof(T)); }
+  static void WriteVec(ofstream& out, const vector<uint32_t>& v) {
+    WritePOD(out, (int)v.size());
+    out.write((const char*)v.data(), v.size()*sizeof(uint32_t));
+  }
+  static void ReadVec(ifstream& in, vector<uint32_t>& v) {
+    int n=0;
+    ReadPOD(in, n);
+    if (!in || n < 0) return;
+    v.resize(n);
+    in.read((char*)v.data(), n*sizeof(uint32_t));
+  }
+  static void WriteStrMap(ofstream& out, const map<int,string>& m) {
+    WritePOD(out, (int)m.size());
+    for (auto& d : m) { WritePOD(out, d.first); WritePOD(out, (int)d.second.size()); out.write(d.second.data(), d.second.size()); }
+  }
+  static void ReadStrMap(ifstream& in, map<int,string>& m) {
+    int n=0;
+    ReadPOD(in, n);
+    for (int j = 0; j < n && in; j++) {
+      int chan=0, len=0;
+      ReadPOD(in, chan); ReadPOD(in, len);
+      if (!in || len < 0) return;
+      string str(len, ' ');
+      in.read(&str[0], len);
+      m[chan] = str;
+    }
+  }
+};
+
+
+// Dense channel-indexed flags and hit slots, for O(1) per-hit channel lookups.
+// SetRun marks the run's pulser monitor channels.  The table grows to cover
+// any channel it's given, and cryostat-0 flags are kept across runs.
+struct ChannelSlots
+{
+  int chMin = 0;
+  vector<int> hitIdx;           // index of this channel's hit in the current event, or -1
+  vector<char> pulserMon, cryo0;
+
+  int Slot(int chan) const {
+    int s = chan - chMin;
+    return (s >= 0 && s < (int)hitIdx.size()) ? s : -1;
+  }
+
+  void Include(int chan)
+  {
+    if (hitIdx.empty()) chMin = chan;
+    if (chan < chMin) {
+      int n = chMin - chan;
+      hitIdx.insert(hitIdx.begin(), n, -1);
+      pulserMon.insert(pulserMon.begin(), n, 0);
+      cryo0.insert(cryo0.begin(), n, 0);
+      chMin = chan;
+    }
+    else if (chan - chMin >= (int)hitIdx.size()) {
+      size_t n = chan - chMin + 1;
+      hitIdx.resize(n, -1);
+      pulserMon.resize(n, 0);
+      cryo0.resize(n, 0);
+    }
+  }
+
+  void SetRun(const RunMetadata& meta)
+  {
+    for (auto& c : meta.chanCard) Include(c.first);
+    for (auto chan : meta.pulserChans) Include((int)chan);
+    fill(pulserMon.begin(), pulserMon.end(), 0);
+    for (auto chan : meta.pulserChans) pulserMon[Slot((int)chan)] = 1;
+  }
+
+  bool IsPulserMon(int chan) const {
+    int s = Slot(chan);
+    return (s >= 0 && pulserMon[s]);
+  }
+
+  // Hit index of this channel in the current event, or -1.
+  int HitIndex(int chan) const {
+    int s = Slot(chan);
+    return (s >= 0) ? hitIdx[s] : -1;
+  }
+  void SetHit(int chan, int i) { Include(chan); hitIdx[Slot(chan)] = i; }
+  void ClearHit(int chan) { int s = Slot(chan); if (s >= 0) hitIdx[s] = -1; }
+
+  // Returns true the first time a channel is flagged.
+  bool FlagCryo0(int chan) {
+    Include(chan);
+    char& f = cryo0[Slot(chan)];
+    bool isNew = !f;
+    f = 1;
+    return isNew;
+  }
+};
+
+
+// Time of the most recent pulser on each digitizer card (key 100*VME + card slot), for dtPulserCard.
+// Channels are mapped to cards from the run's channel map.  Channels that aren't in the map
+// belong to "card 0", which is never updated.  It reads 0, or -1 if the map has a card 0.
+struct PulserCardTimes
+{
+  int chMin = 0;
+  vector<int> chanCard;                            // channel - chMin -> card key, 0 if none
+  vector<double> lastPulse = vector<double>(1, 0); // card key -> last pulser time, -1 if none yet
+
+  void SetRun(const RunMetadata& meta)
+  {
+    chanCard.clear();
+    if (meta.chanCard.empty()) return;
+    chMin = meta.chanCard.begin()->first;
+    chanCard.assign(meta.chanCard.rbegin()->first - chMin + 1, 0);
+    int cardMax = 0;
+    for (auto& c : meta.chanCard) {
+      chanCard[c.first - chMin] = c.second;
+      cardMax = max(cardMax, c.second);
+      if (c.second == 0) lastPulse[0] = -1.;
+    }
+    if ((int)lastPulse.size() <= cardMax) lastPulse.resize(cardMax + 1, -1.);
+  }
+
+  int Card(int chan) const {
+    int s = chan - chMin;
+    return (s >= 0 && s < (int)chanCard.size()) ? chanCard[s] : 0;
+  }
+
+  // Returns false (and does nothing) for channels without a card, e.g. pulser monitors.
+  bool Update(int chan, double t) {
+    int c = Card(chan);
+    if (c <= 0) return false;
+    lastPulse[c] = t;
+    return true;
+  }
+
+  double LastPulse(int chan) const { return lastPulse[max(0, Card(chan))]; }
+};
+
+
+// Files matching a shell pattern like "~/project/cal-skim/skimDS1*", sorted.  No shell is started.
+vector<string> GlobFiles(string pattern)
+{
+  vector<string> files;
+  glob_t fileGlob;
+  if (glob(pattern.c_str(), GLOB_TILDE, NULL, &fileGlob) == 0) {
+    for (size_t i = 0; i < fileGlob.gl_pathc; i++) files.push_back(fileGlob.gl_pathv[i]);
+    globfree(&fileGlob);
+  }
+  sort(files.begin(), files.end());
+  return files;
+}
+
+
+// Sharded skim output (skim_mjd_data -s): one run<N>.root file per run in a directory,
+// plus index.txt with each run's entry count and its first entry in the combined view.
+// MakeChain gives the entry counts to TChain, so no shard is opened until it's read.
+struct SkimShards
+{
+  struct Shard { int run; Long64_t entries, firstEntry; string file; };
+  string dir;
+  vector<Shard> shards; // sorted by run
+
+  static string ShardFile(string shardDir, int run) { return shardDir + "/run" + to_string(run) + ".root"; }
+
+  // (Re)build index.txt from the shards found in a directory.
+  static bool WriteIndex(string shardDir)
+  {
+    vector<int> runs;
+    for (auto name : GlobFiles(shardDir + "/run*.root")) {
+      name = name.substr(name.rfind("/run") + 4);
+      runs.push_back(atoi(name.c_str()));
+    }
+    sort(runs.begin(), runs.end());
+
+    ofstream out((shardDir + "/index.txt").c_str());
+    if (!out) {
+      cout << "SkimShards: Couldn't write " << shardDir << "/index.txt\n";
+      return false;
+    }
+    out << "# run entries firstEntry file\n";
+    Long64_t firstEntry = 0;
+    for (auto run : runs) {
+      TFile *f = TFile::Open(ShardFile(shardDir, run).c_str(), "READ");
+      TTree *t = (f == NULL) ? NULL : (TTree*)f->Get("skimTree");
+      if (t == NULL) {
+        cout << "SkimShards: No skimTree in the shard for run " << run << ", leaving it out.\n";
+        if (f != NULL) f->Close();
+        continue;
+      }
+      Long64_t entries = t->GetEntries();
+      f->Close();
+      out << run << " " << entries << " " << firstEntry << " run" << run << ".root\n";
+      firstEntry += entries;
+    }
+    return true;
+  }
+
+  bool Load(string shardDir)
+  {
+    dir = shardDir;
+    shards.clear();
+    ifstream in((dir + "/index.txt").c_str());
+    if (!in) {
+      cout << "SkimShards: Couldn't open " << dir << "/index.txt\n";
+      return false;
+    }
+    string line;
+    while (getline(in, line)) {
+      if (line.empty() || line[0] == '#') continue;
+      Shard s;
+      istringstream iss(line);
+      if (iss >> s.run >> s.entries >> s.firstEntry >> s.file) shards.push_back(s);
+    }
+    sort(shards.begin(), shards.end(), [](const Shard& a, const Shard& b) { return a.run < b.run; });
+    return true;
+  }
+
+  Long64_t GetEntries() const { return shards.empty() ? 0 : shards.back().firstEntry + shards.back().entries; }
+
+  const Shard* Find(int run) const
+  {
+    auto it = lower_bound(shards.begin(), shards.end(), run,
+      [](const Shard& s, int r) { return s.run < r; });
+    return (it != shards.end() && it->run == run) ? &(*it) : NULL;
+  }
+
+  // Shard holding an entry of the combined view (like TChain::LoadTree).
+  const Shard* Locate(Long64_t entry) const
+  {
+    auto it = upper_bound(shards.begin(), shards.end(), entry,
+      [](Long64_t e, const Shard& s) { return e < s.firstEntry; });
+    if (it == shards.begin()) return NULL;
+    --it;
+    return (entry < it->firstEntry + it->entries) ? &(*it) : NULL;
+  }
+
+  // Chain of all shards, or only the given runs.  The caller owns it.
+  // Other trees in the shards (e.g. pulserTree) are opened to count their entries.
+  TChain* MakeChain(string treeName="skimTree") const
+  {
+    TChain *ch = new TChain(treeName.c_str());
+    for (auto& s : shards) ch->AddFile((dir + "/" + s.file).c_str(), (treeName=="skimTree") ? s.entries : 0);
+    return ch;
+  }
+
+  TChain* MakeChain(const vector<int>& runs, string treeName="skimTree") const
+  {
+    TChain *ch = new TChain(treeName.c_str());
+    for (auto run : runs) {
+      const Shard *s = Find(run);
+      if (s == NULL) { cout << "SkimShards: No shard for run " << run << endl; continue; }
+      ch->AddFile((dir + "/" + s->file).c_str(), (treeName=="skimTree") ? s->entries : 0);
+    }
+    return ch;
+  }
+};
+
+
+// Compact waveform columns (wave-skim -w).  Each hit's samples are stored as zigzag varint
+// deltas, packed into one byte vector per entry, along with its length, sampling period and tOffset.
+// Get decodes one hit into a reused buffer and returns a span over it, so no MGTWaveforms are made.
+struct CompactWaves
+{
+  struct Span {
+    const int* data;
+    size_t size;
+    double period, tOffset;
+    int operator[](size_t i) const { return data[i]; }
+    const int* begin() const { return data; }
+    const int* end() const { return data + size; }
+  };
+
+  bool isMS = false;
+  vector<int> length;             // samples in each hit
+  vector<unsigned int> offset;    // first byte of each hit in data
+  vector<double> period, tOffset; // sampling period and time offset of each hit
+  vector<unsigned char> data;     // packed samples
+  vector<int> buf;                // decoded samples of the last Get
+  vector<TBranch*> branches;
+  TTree *tree = NULL;
+  int treeNumber = -1;
+
+  CompactWaves() {}
+  CompactWaves(const CompactWaves&) = delete; // branch addresses point at the members
+
+  size_t Size() const { return length.size(); }
+
+  void Clear() {
+    length.clear();
+    offset.clear();
+    period.clear();
+    tOffset.clear();
+    data.clear();
+  }
+
+  void Swap(CompactWaves& other) {
+    swap(isMS, other.isMS);
+    length.swap(other.length);
+    offset.swap(other.offset);
+    period.swap(other.period);
+    tOffset.swap(other.tOffset);
+    data.swap(other.data);
+  }
+
+  // Append a hit.  Samples are rounded to integers; returns false if any weren't integers already.
+  bool Add(const double* samples, size_t n, double per, double tOff)
+  {
+    bool exact = true;
+    offset.push_back(data.size());
+    length.push_back(n);
+    period.push_back(per);
+    tOffset.push_back(tOff);
+    int prev = 0;
+    for (size_t i = 0; i < n; i++) {
+      int s = (int)lround(samples[i]);
+      if (s != samples[i]) exact = false;
+      unsigned int d = (unsigned int)s - (unsigned int)prev;
+      unsigned int z = (d << 1) ^ (0u - (d >> 31));
+      prev = s;
+      while (z >= 0x80) {
+        data.push_back((unsigned char)((z & 0x7f) | 0x80));
+        z >>= 7;
+      }
+      data.push_back((unsigned char)z);
+    }
+    return exact;
+  }
+
+  // The span is valid until the next Get.
+  Span Get(size_t k)
+  {
+    buf.resize(length[k]);
+    const unsigned char* p = data.data() + offset[k];
+    int prev = 0;
+    for (int i = 0; i < length[k]; i++) {
+      unsigned int z = 0;
+      int shift = 0;
+      unsigned char c;
+      do {
+        c = *p++;
+        z |= (unsigned int)(c & 0x7f) << shift;
+        shift += 7;
+      } while (c & 0x80);
+      prev += (int)((z >> 1) ^ (0u - (z & 1)));
+      buf[i] = prev;
+    }
+    Span sp = {buf.data(), buf.size(), period[k], tOffset[k]};
+    return sp;
+  }
+
+  // Writing: make the branches on a tree (which may already have entries), then FillBranches per entry.
+  void Branch(TTree *t)
+  {
+    branches.clear();
+    branches.push_back(t->Branch("wfMS", &isMS, "wfMS/O"));
+    branches.push_back(t->Branch("wfLength", &pLength));
+    branches.push_back(t->Branch("wfOffset", &pOffset));
+    branches.push_back(t->Branch("wfPeriod", &pPeriod));
+    branches.push_back(t->Branch("wfTOffset", &pTOffset));
+    branches.push_back(t->Branch("wfData", &pData));
+  }
+
+  void FillBranches() { for (auto b : branches) b->Fill(); }
+
+  // Reading: GetEntry only reads the waveform branches, and works on TChains.
+  bool SetBranches(TTree *t)
+  {
+    if (t->GetBranch("wfData") == NULL) {
+      cout << "CompactWaves: No compact waveform branches found.\n";
+      return false;
+    }
+    tree = t;
+    treeNumber = -1;
+    t->SetBranchAddress("wfMS", &isMS);
+    t->SetBranchAddress("wfLength", &pLength);
+    t->SetBranchAddress("wfOffset", &pOffset);
+    t->SetBranchAddress("wfPeriod", &pPeriod);
+    t->SetBranchAddress("wfTOffset", &pTOffset);
+    t->SetBranchAddress("wfData", &pData);
+    return true;
+  }
+
+  bool GetEntry(Long64_t entry)
+  {
+    Long64_t local = tree->LoadTree(entry);
+    if (local < 0) return false;
+    if (tree->GetTreeNumber() != treeNumber) {
+      treeNumber = tree->GetTreeNumber();
+      branches.clear();
+      for (auto name : {"wfMS", "wfLength", "wfOffset", "wfPeriod", "wfTOffset", "wfData"})
+        branches.push_back(tree->GetBranch(name));
+    }
+    for (auto b : branches) b->GetEntry(local);
+    return true;
+  }
+
+  // branch addresses
+  vector<int> *pLength = &length;
+  vector<unsigned int> *pOffset = &offset;
+  vector<double> *pPeriod = &period, *pTOffset = &tOffset;
+  vector<unsigned char> *pData = &data;
+};
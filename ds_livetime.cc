@@ -11,8 +11,14 @@
 #include <ctime>
 #include <sstream>
 #include <iterator>
-#include <array>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "TFile.h"
+#include "TROOT.h"
 #include "TChain.h"
 #include "TTreeReader.h"
 #include "TTreeReaderArray.h"
@@ -26,17 +32,18 @@
 using namespace std;
 using namespace MJDB;
 
-void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, bool noDT,
-  map<int,vector<string>> ranges = map<int,vector<string>>(),
+struct DeadtimeIndex;
+void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, bool noDT, int nThreads,
+  const DeadtimeIndex& dtIndex,
   vector<pair<int,double>> times = vector<pair<int,double>>(),
   map<int,vector<int>> burst = map<int,vector<int>>());
 
-bool compareInterval(pair<int,int> i1, pair<int,int> i2) { return (i1.first < i2.first); }
-int mergeIntervals(vector<pair<int,int>> vals, int start, int stop);
 map<int,vector<int>> LoadBurstCut();
 void getDBRunList(int &dsNum, double &ElapsedTime, string options, vector<int> &runList, vector<pair<int,double>> &times);
-void locateRunRange(int run, map<int,vector<string>> ranges, int& runInSet, string& dtFilePath, bool& noDT);
-map<int, vector<string>> getDeadtimeMap(int dsNum, bool& noDT, int dsNum_hi=-1) ;
+string getLivetimeCachePath(int dsNum);
+string fileVersion(string path);
+string dirVersion(string path);
+uint64_t hashBytes(const void* data, size_t n, uint64_t h=14695981039346656037ULL);
 double getTotalLivetimeUncertainty(map<int, double> livetimes, string opt="");
 double getLivetimeAverage(map<int, double> livetimes, string opt="");
 double getVectorUncertainty(vector<double> aVector);
@@ -49,6 +56,303 @@ bool check_num(std::string const &in) {
     return !in.empty() && *end == '\0';
 }
 
+// Everything calculateLiveTime needs from one run, so the runs can be scanned in parallel
+// and added up afterwards.  Times are in seconds.
+struct RunLivetimeRecord
+{
+  struct Channel {
+    uint32_t chan = 0;
+    int detID = -1;
+    string pos;               // detector position, the key in the DT file
+    bool hasDT = false;
+    double dt[6] = {0};       // DT file entry: hgDead, lgDead, orDead (percent), hg, lg, or pulsers
+  };
+  int run = -1, subset = -1;
+  uint64_t key = 0;           // hash of the inputs this record was made from (see calculateLiveTime)
+  bool found = false;         // got the run info from the built file
+  bool badTimes = false;      // corrupted start/stop packets: counts toward the total runtime only
+  double dsRunTime = 0;       // this run's part of the total runtime (RunDB elapsed time with -db2)
+  double runTime = 0, runTimeUnc = 0;
+  double stop = 0;            // stop time, for the gap check on the next run's veto data
+  double vetoRunTime = 0, vetoDead = 0;
+  long long vetoStart = 0;
+  double vetoGapDead = 0;     // first veto event's window, counted if there's a gap before this run
+  int m1LNDead = 0, m2LNDead = 0;
+  vector<Channel> chans;      // enabled channels that pass the veto-only, bad, and channel selection lists
+};
+
+// On-disk cache of RunLivetimeRecords, one file per data set, next to the run metadata cache.
+// A record is only used if its key matches the one calculateLiveTime expects for the run.
+// Save() merges with whatever is on disk now, like RunMetaCache.
+struct LivetimeCache
+{
+  static const int kVersion = 1;
+  string path;
+  map<int,RunLivetimeRecord> runs;
+  bool dirty = false;
+
+  LivetimeCache(string cachePath="") : path(cachePath) {
+    if (path != "") Read(path, runs);
+  }
+
+  const RunLivetimeRecord* Get(int run, uint64_t key) const
+  {
+    auto it = runs.find(run);
+    if (it == runs.end() || it->second.key != key) return NULL;
+    return &(it->second);
+  }
+
+  void Put(const RunLivetimeRecord& rec)
+  {
+    runs[rec.run] = rec;
+    dirty = true;
+  }
+
+  bool Save()
+  {
+    if (path == "" || !dirty) return true;
+    map<int,RunLivetimeRecord> onDisk;
+    Read(path, onDisk);
+    for (auto& r : onDisk) runs.insert(r); // ours win if both have it
+
+    string tmpPath = path + ".tmp" + to_string((int)getpid());
+    ofstream out(tmpPath.c_str(), ios::binary);
+    if (!out) { cout << "LivetimeCache: Couldn't write " << tmpPath << endl; return false; }
+    out.write("RLIVE", 5);
+    RunMetaCache::WritePOD(out, (int)kVersion);
+    RunMetaCache::WritePOD(out, (int)runs.size());
+    for (auto& r : runs) {
+      const RunLivetimeRecord& rec = r.second;
+      RunMetaCache::WritePOD(out, rec.run);
+      RunMetaCache::WritePOD(out, rec.key);
+      RunMetaCache::WritePOD(out, rec.badTimes);
+      RunMetaCache::WritePOD(out, rec.dsRunTime);
+      RunMetaCache::WritePOD(out, rec.runTime); RunMetaCache::WritePOD(out, rec.runTimeUnc);
+      RunMetaCache::WritePOD(out, rec.stop);
+      RunMetaCache::WritePOD(out, rec.vetoRunTime); RunMetaCache::WritePOD(out, rec.vetoDead);
+      RunMetaCache::WritePOD(out, rec.vetoStart); RunMetaCache::WritePOD(out, rec.vetoGapDead);
+      RunMetaCache::WritePOD(out, rec.m1LNDead); RunMetaCache::WritePOD(out, rec.m2LNDead);
+      RunMetaCache::WritePOD(out, (int)rec.chans.size());
+      for (auto& c : rec.chans) {
+        RunMetaCache::WritePOD(out, c.chan);
+        RunMetaCache::WritePOD(out, c.detID);
+        RunMetaCache::WritePOD(out, (int)c.pos.size());
+        out.write(c.pos.data(), c.pos.size());
+        RunMetaCache::WritePOD(out, c.hasDT);
+        out.write((const char*)c.dt, sizeof(c.dt));
+      }
+    }
+    out.close();
+    if (!out || rename(tmpPath.c_str(), path.c_str()) != 0) {
+      cout << "LivetimeCache: Couldn't save " << path << endl;
+      remove(tmpPath.c_str());
+      return false;
+    }
+    dirty = false;
+    return true;
+  }
+
+  static bool Read(string cachePath, map<int,RunLivetimeRecord>& out)
+  {
+    ifstream in(cachePath.c_str(), ios::binary);
+    if (!in) return false;
+    char magic[5];
+    int version=0, nRuns=0;
+    in.read(magic, 5);
+    RunMetaCache::ReadPOD(in, version);
+    if (!in || string(magic,5) != "RLIVE" || version != kVersion) {
+      cout << "LivetimeCache: Ignoring " << cachePath << " (unknown format)\n";
+      return false;
+    }
+    RunMetaCache::ReadPOD(in, nRuns);
+    for (int i = 0; i < nRuns && in; i++) {
+      RunLivetimeRecord rec;
+      int nChans=0;
+      rec.found = true;
+      RunMetaCache::ReadPOD(in, rec.run);
+      RunMetaCache::ReadPOD(in, rec.key);
+      RunMetaCache::ReadPOD(in, rec.badTimes);
+      RunMetaCache::ReadPOD(in, rec.dsRunTime);
+      RunMetaCache::ReadPOD(in, rec.runTime); RunMetaCache::ReadPOD(in, rec.runTimeUnc);
+      RunMetaCache::ReadPOD(in, rec.stop);
+      RunMetaCache::ReadPOD(in, rec.vetoRunTime); RunMetaCache::ReadPOD(in, rec.vetoDead);
+      RunMetaCache::ReadPOD(in, rec.vetoStart); RunMetaCache::ReadPOD(in, rec.vetoGapDead);
+      RunMetaCache::ReadPOD(in, rec.m1LNDead); RunMetaCache::ReadPOD(in, rec.m2LNDead);
+      RunMetaCache::ReadPOD(in, nChans);
+      for (int j = 0; j < nChans && in; j++) {
+        RunLivetimeRecord::Channel c;
+        int len=0;
+        RunMetaCache::ReadPOD(in, c.chan);
+        RunMetaCache::ReadPOD(in, c.detID);
+        RunMetaCache::ReadPOD(in, len);
+        if (!in || len < 0) return false;
+        c.pos.resize(len);
+        in.read(&c.pos[0], len);
+        RunMetaCache::ReadPOD(in, c.hasDT);
+        in.read((char*)c.dt, sizeof(c.dt));
+        rec.chans.push_back(c);
+      }
+      if (in) out[rec.run] = rec;
+    }
+    return true;
+  }
+};
+
+// Run ranges and dead times from the ./deadtime/*.lis and *.DT files, all read once by Load.
+// Each .lis file is one subset (its first to last run), and the .DT file with the same name has
+// each detector's hardware deadtime and pulser counts for that subset.  Find is a binary search
+// over the run ranges, and the dead times are a dense (subset, detector position) table.
+struct DeadtimeIndex
+{
+  vector<string> dtFiles;         // subset -> .DT file
+  vector<char> dtLoaded;          // subset -> .DT file was read
+  vector<int> firstRun, lastRun;  // subset -> run range
+  vector<int> byFirstRun;         // subsets sorted by first run
+  bool overlaps = false;          // some run ranges overlap: Find falls back to a linear search
+  map<string,int> posIndex;       // detector position -> table column
+  vector<vector<double>> table;   // subset -> {hgDead,lgDead,orDead,hgPulsers,lgPulsers,orPulsers} for each column
+  vector<vector<char>> hasPos;    // subset -> column is in the .DT file
+
+  // Load the files for data sets dsNum to dsNum_hi.  Sets noDT if a data set has none.
+  void Load(int dsNum, bool& noDT, int dsNum_hi=-1)
+  {
+    vector<int> dsList;
+    if (dsNum_hi == -1) dsList = {dsNum};
+    else
+      for (int i = dsNum; i <= dsNum_hi; i++)
+        dsList.push_back(i);
+
+    vector<vector<pair<int,vector<double>>>> rows; // subset -> (column, DT entry)
+    for (auto ds : dsList)
+    {
+      vector<string> files = GlobFiles(ds==5 ? "./deadtime/DS*.lis" : Form("./deadtime/ds%i_*.lis",ds));
+      if (files.size()==0) {
+        noDT=1;
+        break;
+      }
+
+      // Build the ranges.  Quit at the first sign of trouble.
+      bool lisOK = true;
+      for (auto file : files)
+      {
+        ifstream lisFile(file.c_str());
+        if (!lisFile) {
+          cout << "Couldn't find file: " << file << endl;
+          lisOK = false;
+          break;
+        }
+        string buffer;
+        int first = -1, last = -1;
+        while (getline(lisFile, buffer))
+        {
+          size_t found = buffer.find("Run");
+          if (found == string::npos) {
+            cout << "Couldn't find a run expression in " << buffer << endl;
+            lisOK = false;
+            break;
+          }
+          int run = stoi( buffer.substr(found+3) );
+          if (first == -1) first = run;
+          last = run;
+        }
+        if (!lisOK) break;
+
+        // grab the corresponding DT file
+        string dtFile = file.substr(0, file.find_last_of(".")) + ".DT";
+        dtFiles.push_back(dtFile);
+        firstRun.push_back(first);
+        lastRun.push_back(last);
+        rows.push_back(vector<pair<int,vector<double>>>());
+        dtLoaded.push_back(ReadDT(dtFile, rows.back()));
+      }
+      if (!lisOK) break;
+    }
+
+    // Fill the dense table, now that every detector position has a column.
+    size_t nPos = posIndex.size();
+    table.assign(dtFiles.size(), vector<double>(6*nPos, 0));
+    hasPos.assign(dtFiles.size(), vector<char>(nPos, 0));
+    for (size_t s = 0; s < rows.size(); s++)
+      for (auto& row : rows[s]) {
+        copy(row.second.begin(), row.second.end(), table[s].begin() + 6*row.first);
+        hasPos[s][row.first] = 1;
+      }
+
+    byFirstRun.resize(dtFiles.size());
+    for (size_t s = 0; s < byFirstRun.size(); s++) byFirstRun[s] = s;
+    stable_sort(byFirstRun.begin(), byFirstRun.end(), [&](int a, int b) { return firstRun[a] < firstRun[b]; });
+    for (size_t i = 1; i < byFirstRun.size(); i++)
+      if (firstRun[byFirstRun[i]] <= lastRun[byFirstRun[i-1]]) {
+        cout << "Warning: " << dtFiles[byFirstRun[i-1]] << " and " << dtFiles[byFirstRun[i]] << " have overlapping run ranges.\n"
+             << "         Runs will use the first file listed that covers them.\n";
+        overlaps = true;
+      }
+    cout << "Loaded " << dtFiles.size() << " deadtime files, " << nPos << " detector positions.\n";
+  }
+
+  // Reads one .DT file.  The last one read wins if a detector position is listed twice.
+  bool ReadDT(string dtFilePath, vector<pair<int,vector<double>>>& dtRows)
+  {
+    ifstream dtFile(dtFilePath.c_str());
+    if (!dtFile) return false;
+    for (int i = 0; i < 2; i++) dtFile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+    string buffer;
+    map<int,size_t> rowOfPos;
+    while (getline(dtFile, buffer))
+    {
+      int id, pos;
+      double p1, p2, p3, p4, p5, p6; // # pulsers in: HG, LG, OR, Expected.  p5 and p6 are error codes
+      double hgFWHM, hgNeg, hgPos, hgDead;
+      double lgFWHM, lgNeg, lgPos, lgDead;
+      double orDead;
+      string det;
+      istringstream iss(buffer);
+      iss >> id >> pos >> hgFWHM >> hgNeg >> hgPos >> hgDead
+          >> lgFWHM >> lgNeg >> lgPos >> lgDead >> orDead
+          >> det >> p1 >> p2 >> p3 >> p4 >> p5 >> p6;
+
+      // Check if anything is nan.  We'll take it to mean 100% dead.
+      // This is maximally conservative, as it could be 100% live.
+      if(hgDead != hgDead) hgDead = 100.0;
+      if(lgDead != lgDead) lgDead = 100.0;
+      if(orDead != orDead) orDead = 100.0;
+
+      auto col = posIndex.insert(make_pair(det, (int)posIndex.size())).first->second;
+      vector<double> entry = {hgDead,lgDead,orDead,p1,p2,p3};
+      if (rowOfPos.find(col) != rowOfPos.end()) dtRows[rowOfPos[col]].second = entry;
+      else {
+        rowOfPos[col] = dtRows.size();
+        dtRows.push_back(make_pair(col, entry));
+      }
+    }
+    return true;
+  }
+
+  // Subset containing this run, or -1.  If ranges overlap, it's the first subset (in file order) that has it.
+  int Find(int run) const
+  {
+    if (overlaps) {
+      for (size_t s = 0; s < firstRun.size(); s++)
+        if (run >= firstRun[s] && run <= lastRun[s]) return s;
+      return -1;
+    }
+    auto it = upper_bound(byFirstRun.begin(), byFirstRun.end(), run,
+      [&](int val, int s) { return val < firstRun[s]; });
+    if (it == byFirstRun.begin()) return -1;
+    --it;
+    return (run <= lastRun[*it]) ? *it : -1;
+  }
+
+  // The six DT file values for a detector position in a subset, or NULL if it's not in the file.
+  const double* Get(int subset, const string& pos) const
+  {
+    auto it = posIndex.find(pos);
+    if (it == posIndex.end() || !hasPos[subset][it->second]) return NULL;
+    return &table[subset][6*it->second];
+  }
+};
+
 // =======================================================================================
 int main(int argc, char** argv)
 {
@@ -62,6 +366,7 @@ int main(int argc, char** argv)
          << "   -db1 ['options in quotes']: Get run list from runDB and quit\n"
          << "   -db2 ['options in quotes']: Do full LT calculation on a runDB list\n"
          << "   -low: GDS method + low energy run/channel selection list.\n"
+         << "   -t [nThreads]: Number of runs to scan at once (default 1)\n"
          << " RunDB access (-db[12] option):\n"
          << "    partNum = P3LQK, P3KJR, P3LQG, etc.\n"
          << "    runRank = gold, silver, bronze, cal, etc.\n"
@@ -71,7 +376,7 @@ int main(int argc, char** argv)
 		return 1;
 	}
   bool raw=0, gds=0, lt=1, rdb=0, low=0, noDT=0, ds5a=0, ds5b=0;
-  int dsNum;
+  int dsNum, nThreads=1;
   string dsStr = argv[1];
   if (check_num(dsStr)) dsNum = stoi(dsStr);
   else {
@@ -86,6 +391,7 @@ int main(int argc, char** argv)
     if (opt[i] == "-db1") { lt=0; rdb=1; runDBOpt = opt[i+1]; }
     if (opt[i] == "-db2") { lt=1; rdb=1; runDBOpt = opt[i+1]; }
     if (opt[i] == "-low") { lt=0; low=1; }
+    if (opt[i] == "-t") { nThreads = max(1, stoi(opt[i+1])); }
   }
 
   // -- Primary livetime routine, using DataSetInfo run sequences (default, no extra args) --
@@ -98,10 +404,11 @@ int main(int argc, char** argv)
     else         for (int rs = 0; rs <= GetDataSetSequences(dsNum); rs++) LoadDataSet(ds, dsNum, rs);
 
     for (size_t i = 0; i < ds.GetNRuns(); i++) runList.push_back(ds.GetRunNumber(i));
-    map<int, vector<string>> ranges = getDeadtimeMap(dsNum,noDT);
+    DeadtimeIndex dtIndex;
+    dtIndex.Load(dsNum,noDT);
 
     // -- Main routine --
-    calculateLiveTime(runList,dsNum,raw,rdb,noDT,ranges);
+    calculateLiveTime(runList,dsNum,raw,rdb,noDT,nThreads,dtIndex);
   }
 
   // -- Do SIMPLE GATDataSet method and quit (-gds) --
@@ -129,9 +436,10 @@ int main(int argc, char** argv)
     vector<int> runList;
     vector<pair<int,double>> times;
     getDBRunList(dsNum, ElapsedTime, runDBOpt, runList, times); // auto-detects dsNum
-    map<int, vector<string>> ranges = getDeadtimeMap(0,noDT,5); // we don't know what DS we're in, so load them all.
+    DeadtimeIndex dtIndex;
+    dtIndex.Load(0,noDT,5); // we don't know what DS we're in, so load them all.
     // -- Main routine --
-    calculateLiveTime(runList,dsNum,raw,rdb,noDT,ranges,times);
+    calculateLiveTime(runList,dsNum,raw,rdb,noDT,nThreads,dtIndex,times);
   }
 
   // -- Do primary livetime with a low-energy run+channels 'burst' cut applied. --
@@ -141,18 +449,19 @@ int main(int argc, char** argv)
     cout << "Scanning DS-" << dsNum << endl;
     for (int rs = 0; rs <= GetDataSetSequences(dsNum); rs++) LoadDataSet(ds, dsNum, rs);
     for (size_t i = 0; i < ds.GetNRuns(); i++) runList.push_back(ds.GetRunNumber(i));
-    map<int, vector<string>> ranges = getDeadtimeMap(dsNum,noDT);
+    DeadtimeIndex dtIndex;
+    dtIndex.Load(dsNum,noDT);
     map<int,vector<int>> burst = LoadBurstCut(); // (low-energy run+channel selection)
 
     // -- Main routine --
     vector<pair<int,double>> times; // dummy (empty)
-    calculateLiveTime(runList,dsNum,raw,rdb,noDT,ranges,times,burst);
+    calculateLiveTime(runList,dsNum,raw,rdb,noDT,nThreads,dtIndex,times,burst);
   }
 }
 // =======================================================================================
 
-void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, bool noDT,
-  map<int,vector<string>> ranges,
+void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, bool noDT, int nThreads,
+  const DeadtimeIndex& dtIndex,
   vector<pair<int,double>> times,
   map<int,vector<int>> burst)
 {
@@ -172,11 +481,22 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
     useBurst=1;
   }
 
-  // Load LN fill times
+  // Load LN fill times, and merge their veto windows
   double loFill = 15*60, hiFill = 5*60; // veto window
   vector<double> lnFillTimes[2];
   if (mod1) LoadLNFillTimes1(lnFillTimes[0], dsNum);
   if (mod2) LoadLNFillTimes2(lnFillTimes[1], dsNum);
+  LNFillVeto lnVeto[2];
+  for (int mod = 0; mod < 2; mod++) lnVeto[mod].Build(lnFillTimes[mod], loFill, hiFill);
+
+  // DS-4 uses a static muon list
+  MuonIndex ds4Muons;
+  if (dsNum == 4) {
+    vector<int> muRuns, muTypes;
+    vector<double> muRunTStarts, muTimes, muUncert;
+    LoadDS4MuonList(muRuns,muRunTStarts,muTimes,muTypes,muUncert);
+    ds4Muons.Build(muRuns,muRunTStarts,muTimes,muTypes,muUncert);
+  }
 
   // Load detector maps
   map<int,bool> detIDIsBad = LoadBadDetectorMap(dsNum);
@@ -185,130 +505,175 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
   map<int,double> actMUnc4Det_g = LoadActiveMassUncertainties(dsNum);
   map<int,bool> detIsEnr = LoadEnrNatMap();
 
+  // Built file headers (start/stop times, enabled channels) come from the run metadata cache
+  RunMetaCache runMeta(GetRunMetaCachePath(dsNum));
 
-  // ====== Loop over runs ======
-  double runTime=0, vetoRunTime=0, vetoDead=0, m1LNDead=0, m2LNDead=0;
-  map <int,double> channelRuntime, channelLivetime, channelLivetimeBest;
-  map <int,double> channelRuntimeStd2;
-  map <int,int> detChanToDetIDMap;
-  map <int,vector<double>> livetimeMap, livetimeMapBest;
-  map<string, vector<double>> dtMap;
-  bool firstTimeInSubset=true;     // Allows us to only add in pulser deadtime once per subset
-  double dtfRunTime=0;             // dummy runtime for deadtime fraction (hg and lg det's)
-  double dtfRunTimeBest=0;         // dummy runtime for deadtime fraction ('best' det's)
-  vector<double> dtfDeadTime(10,0); // individual deadtimes
-  time_t prevStop=0;
-  int prevSubSet=-1;
+  // ====== Look up each run's subset, deadtime file, and run info ======
+  // This is done in run order on one thread: a run without a deadtime file switches off
+  // the deadtime calculation for the rest of the list, and RunMetaCache isn't thread-safe.
+  vector<int> runSubset(runList.size(),-1);
+  vector<string> runDTFile(runList.size());
+  vector<const RunMetadata*> runInfo(runList.size(),NULL);
   for (size_t r = 0; r < runList.size(); r++)
   {
-    int run = runList[r];
-    // cout << "Scanning run " << run << endl;
-    if (fmod(100*(double)r/runList.size(), 10.0) < 0.1)
-      cout << 100*(double)r/runList.size() << " % done, run " << run << endl;
-
-     // Load the deadtime file ONLY when the subset changes.
-    int runInSet = -1;
-    string dtFilePath;
-    if (!noDT) locateRunRange(run,ranges,runInSet,dtFilePath,noDT);
-    if (!noDT && (runInSet != prevSubSet))
-    {
-      cout << "Subset " << runInSet << ", loading DT file:" << dtFilePath << endl;
-      firstTimeInSubset = true;
-
-      ifstream dtFile(dtFilePath.c_str());
-      if (!dtFile) {
-        cout << "Couldn't find file: " << dtFilePath << endl;
-        return;
+    if (!noDT) {
+      runSubset[r] = dtIndex.Find(runList[r]);
+      if (runSubset[r] < 0) {
+        cout << "Couldn't find deadtime file for run " << runList[r] << ". Reverting to runtime-only calculation ...\n";
+        noDT = true;
       }
-      for (int i = 0; i < 2; i++) dtFile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-      string buffer;
-      dtMap.clear();
-      while (getline(dtFile, buffer))
-      {
-        int id, pos;
-        double p1, p2, p3, p4, p5, p6; // # pulsers in: HG, LG, OR, Expected.  p5 and p6 are error codes
-        double hgFWHM, hgNeg, hgPos, hgDead;
-        double lgFWHM, lgNeg, lgPos, lgDead;
-        double orDead;
-        string det;
-        istringstream iss(buffer);
-        iss >> id >> pos >> hgFWHM >> hgNeg >> hgPos >> hgDead
-            >> lgFWHM >> lgNeg >> lgPos >> lgDead >> orDead
-            >> det >> p1 >> p2 >> p3 >> p4 >> p5 >> p6;
-        // cout << Form("%i %i %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %s %.0f %.0f %.0f %.0f %.0f %.0f\n" ,id,pos,hgFWHM,hgNeg,hgPos,hgDead,lgFWHM,lgNeg,lgPos,lgDead,orDead,det.c_str(),p1,p2,p3,p4,p5,p6);
-
-        // Check if anything is nan.  We'll take it to mean 100% dead.
-        // This is maximally conservative, as it could be 100% live.
-        if(hgDead != hgDead) hgDead = 100.0;
-        if(lgDead != lgDead) lgDead = 100.0;
-        if(orDead != orDead) orDead = 100.0;
-
-        // fill the deadtime map
-        dtMap[det] = {hgDead,lgDead,orDead,p1,p2,p3};
+      else if (!dtIndex.dtLoaded[runSubset[r]]) {
+        cout << "Couldn't find file: " << dtIndex.dtFiles[runSubset[r]] << endl;
+        return;
       }
-
-      // Save the subset number
-      prevSubSet = runInSet;
+      else runDTFile[r] = dtIndex.dtFiles[runSubset[r]];
+    }
+    runInfo[r] = runMeta.Get(runList[r]);
+    if (runInfo[r] != NULL && !runInfo[r]->hasChSet) {
+      cout << "Run " << runList[r] << " has no ChannelSettings in its built file, so its enabled channels are unknown.  Skipping it.\n";
+      runInfo[r] = NULL;
     }
+  }
+  runMeta.Save();
+
+  // ====== Reduce each run to a RunLivetimeRecord, nThreads runs at a time ======
+  // Nothing here depends on the other runs, so the records are added up afterwards, in run order.
+  // NOTE: future versions of this code should use the 'official version' argument in GetChannelSelectionPath.
+  //       but as of 9/8/17 for the 0nbb paper, that directory is empty.  If the 0nbb dataset deadtime needs
+  //       to be recalculated, this change must be made, so that the channel selection files are the same.
+  string chSelPath = GetChannelSelectionPath(dsNum,1);
+  bool useChSel = false;
+  if (FILE *file = fopen(chSelPath.c_str(), "r")) { fclose(file); useChSel = true; }
+  auto isFlagged = [](const map<int,bool>& flags, int detID) {
+    auto it = flags.find(detID);
+    return (it != flags.end() && it->second);
+  };
+
+
+  // A record depends on the run metadata, the deadtime file, the channel selection files, the veto file,
+  // the bad/veto-only lists, the LN fills and DS-4 muon list, and the RunDB times (-db2).
+  // Those go into each run's cache key, so changing any of them redoes only the runs affected.
+  // The burst cut is applied when the records are added up, so it's not part of the key.
+  uint64_t baseKey = hashBytes(&dsNum, sizeof(dsNum));
+  baseKey = hashBytes(&noDT, sizeof(noDT), baseKey);
+  string chSelVersion = chSelPath + (useChSel ? dirVersion(chSelPath) : "");
+  baseKey = hashBytes(chSelVersion.data(), chSelVersion.size(), baseKey);
+  for (auto flags : {&detIDIsBad, &detIDIsVetoOnly})
+    for (auto& d : *flags) {
+      baseKey = hashBytes(&d.first, sizeof(d.first), baseKey);
+      baseKey = hashBytes(&d.second, sizeof(d.second), baseKey);
+    }
+  for (int mod = 0; mod < 2; mod++)
+    baseKey = hashBytes(lnVeto[mod].windows.data(), lnVeto[mod].windows.size()*sizeof(pair<double,double>), baseKey);
+  baseKey = hashBytes(ds4Muons.times.data(), ds4Muons.times.size()*sizeof(double), baseKey);
+  baseKey = hashBytes(ds4Muons.uncert.data(), ds4Muons.uncert.size()*sizeof(double), baseKey);
+  baseKey = hashBytes(ds4Muons.runs.data(), ds4Muons.runs.size()*sizeof(int), baseKey);
+  baseKey = hashBytes(ds4Muons.runTStarts.data(), ds4Muons.runTStarts.size()*sizeof(double), baseKey);
+
+  vector<RunLivetimeRecord> records(runList.size());
+  vector<size_t> toScan;
+  LivetimeCache ltCache(raw ? "" : getLivetimeCachePath(dsNum));
+  map<string,string> dtVersion;
+  for (size_t r = 0; r < runList.size(); r++)
+  {
+    records[r].run = runList[r];
+    records[r].subset = runSubset[r];
+    if (raw) { toScan.push_back(r); continue; }
 
-    // Load built file
     GATDataSet ds;
-    string bltPath = ds.GetPathToRun(run,GATDataSet::kBuilt);
-    TFile *bltFile = new TFile(bltPath.c_str());
+    if (dtVersion.find(runDTFile[r]) == dtVersion.end()) dtVersion[runDTFile[r]] = fileVersion(runDTFile[r]);
+    string runVersion = dtVersion[runDTFile[r]] + fileVersion(ds.GetPathToRun(runList[r],GATDataSet::kVeto));
+    uint64_t key = hashBytes(runVersion.data(), runVersion.size(), baseKey);
+    if (runDB) {
+      key = hashBytes(&times[r].first, sizeof(times[r].first), key);
+      key = hashBytes(&times[r].second, sizeof(times[r].second), key);
+    }
+    if (const RunMetadata *meta = runInfo[r]) {
+      long long unixTimes[2] = {(long long)meta->startUnix, (long long)meta->stopUnix};
+      key = hashBytes(&meta->startClock, sizeof(meta->startClock), key);
+      key = hashBytes(&meta->stopClock, sizeof(meta->stopClock), key);
+      key = hashBytes(unixTimes, sizeof(unixTimes), key);
+      key = hashBytes(meta->enabledIDs.data(), meta->enabledIDs.size()*sizeof(uint32_t), key);
+      for (auto names : {&meta->detNames, &meta->detPos})
+        for (auto& d : *names) {
+          key = hashBytes(&d.first, sizeof(d.first), key);
+          key = hashBytes(d.second.data(), d.second.size()+1, key); // with the terminator, so names can't run together
+        }
+    }
 
+    const RunLivetimeRecord *cached = ltCache.Get(runList[r], key);
+    if (cached != NULL && runInfo[r] != NULL) {
+      records[r] = *cached;
+      records[r].subset = runSubset[r]; // subset numbers depend on which data sets were loaded
+    }
+    else {
+      records[r].key = key;
+      toScan.push_back(r);
+    }
+  }
+  if (!raw) cout << "Found " << runList.size()-toScan.size() << " of " << runList.size() << " runs in the livetime cache.\n";
+
+  ROOT::EnableThreadSafety();
+  mutex coutMutex;
+  atomic<size_t> nextRun(0), nDone(0);
+  auto tStart = chrono::steady_clock::now();
+  auto scanRun = [&](size_t r, GATDetInfoProcessor& gp)
+  {
+    RunLivetimeRecord& rec = records[r];
+    const RunMetadata *meta = runInfo[r];
+    if (meta == NULL) return;
+    rec.found = true;
 
     // Get the runtime for this run.
     // Cover a bunch of stupid edge cases.
-    double start=0, stop=0, thisRunTime=0, thisRuntimeUncertainty=0;
+    double start=0, stop=0;
     time_t startUnix=0, stopUnix=0;
     if (runDB) {
-      runTime += times[r].second;
+      rec.dsRunTime = times[r].second;
       stop = (double)times[r].first;
       start = (double)times[r].first - (double)times[r].second;
-      thisRunTime = (stop-start);
+      rec.runTime = (stop-start);
     }
     else {
-      MJTRun *runInfo = (MJTRun*)bltFile->Get("run");
-      start = runInfo->GetStartClockTime();
-      stop = runInfo->GetStopClockTime();
-      thisRunTime = (stop-start)/1e9;
-      thisRuntimeUncertainty = 10e-9;  // seconds of uncertainty
-      if(thisRunTime < 0) {
-        printf("Error, the runtime is negative! %.1f  -  %.1f  = %.2f   \n",start,stop,thisRunTime);
-        startUnix = runInfo->GetStartTime();
-        stopUnix = runInfo->GetStopTime();
+      start = meta->startClock;
+      stop = meta->stopClock;
+      rec.runTime = (stop-start)/1e9;
+      rec.runTimeUnc = 10e-9;  // seconds of uncertainty
+      if(rec.runTime < 0) {
+        lock_guard<mutex> lock(coutMutex);
+        cout << Form("Error, the runtime is negative! %.1f  -  %.1f  = %.2f   \n",start,stop,rec.runTime);
+        startUnix = meta->startUnix;
+        stopUnix = meta->stopUnix;
         start = startUnix;
         stop = stopUnix;
-        thisRunTime = (stopUnix-startUnix);
-        printf("Reverting to the unix timestamps (%.2f) for run %d \n",thisRunTime,run);
-        thisRuntimeUncertainty = 1;   // 1 second of uncertainty with unix timestamps
-      }      
+        rec.runTime = (stopUnix-startUnix);
+        cout << Form("Reverting to the unix timestamps (%.2f) for run %d \n",rec.runTime,rec.run);
+        rec.runTimeUnc = 1;   // 1 second of uncertainty with unix timestamps
+      }
+      rec.dsRunTime = rec.runTime;
 
-      runTime += thisRunTime;
-      
       // still need unix times for LN fill deadtime calculation
-      startUnix = runInfo->GetStartTime();
-      stopUnix = runInfo->GetStopTime();
-      struct tm *tmStart, *tmStop;  // I dunno if this is the best way to check for bad start/stop vals
-      tmStart = gmtime(&startUnix), tmStop = gmtime(&stopUnix);
-      int yrStart = 1900+tmStart->tm_year, yrStop = 1900+tmStop->tm_year;
+      startUnix = meta->startUnix;
+      stopUnix = meta->stopUnix;
+      struct tm tmStart, tmStop;  // I dunno if this is the best way to check for bad start/stop vals
+      gmtime_r(&startUnix, &tmStart), gmtime_r(&stopUnix, &tmStop);
+      int yrStart = 1900+tmStart.tm_year, yrStop = 1900+tmStop.tm_year;
       if (yrStart < 2005 || yrStart > 2025 || yrStop < 2005 || yrStart > 2025) {
-        cout << Form("Run %i has corrupted start/stop packets.  Start (yr%i) %li  Stop (yr %i) %li.  Continuing...\n", run,yrStart,startUnix,yrStop,stopUnix);
-        continue;
+        lock_guard<mutex> lock(coutMutex);
+        cout << Form("Run %i has corrupted start/stop packets.  Start (yr%i) %li  Stop (yr %i) %li.  Continuing...\n", rec.run,yrStart,startUnix,yrStop,stopUnix);
+        rec.badTimes = true;
+        return;
       }
     }
-    if (raw) {
-      delete bltFile;
-      continue;
-    }
+    rec.stop = stop;
+    if (raw) return;
 
 
     // Get veto system livetime and deadtime.
-    double vetoDeadRun=0;
     if (dsNum!=4)
     {
-      string vetPath = ds.GetPathToRun(run,GATDataSet::kVeto);
+      GATDataSet ds;
+      string vetPath = ds.GetPathToRun(rec.run,GATDataSet::kVeto);
       if (FILE *file = fopen(vetPath.c_str(), "r")) {
         fclose(file);
 
@@ -326,103 +691,55 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
         vStart = (*vetoStart);
         vStop = (*vetoStop);
         if (runDB) {
-          vetoRunTime += times[r].second; // use duration from runDB
+          rec.vetoRunTime = times[r].second; // use duration from runDB
           vStart = start; // use same duration as built files (this is OK)
           vStop = stop;
         }
-        else vetoRunTime += (double)(vStop-vStart);
+        else rec.vetoRunTime = (double)(vStop-vStart);
+        rec.vetoStart = vStart;
         vReader.SetTree(vetTree);  // resets the reader
 
-        // Find veto deadtime
-        bool newRun=1;
+        // Find veto deadtime.  A muon we missed in the gap before this run (type 3)
+        // depends on the previous run's stop time, so that's decided in the reduction.
         while(vReader.Next()) {
           int idx = vReader.GetCurrentEntry();
-          if (idx!=0) newRun=0;
           MJVetoEvent veto = *vetoEventIn;
           int type=0;
           if (CoinType[0]) type=1;
           if (CoinType[1]) type=2; // overrides type 1 if both are true
-          if ((time_t)vStart-prevStop > 10 && newRun) type = 3; // in case we missed a muon in a run gap
-          if (type!=0) {
-            if (veto.GetBadScaler()) *timeUncert = 8.0; // fix uncertainty for corrupted scalers
-            vetoDeadRun += 1. + 2 * fabs(*timeUncert); // matches muVeto window in skim_mjd_data
-            // cout << Form("Run %i  type %i  uncert %-6.4f  vetoDeadRun %-6.4f  vetoDead %-6.4f\n", run,type,*timeUncert,vetoDeadRun,vetoDead);
-          }
+          if (veto.GetBadScaler()) *timeUncert = 8.0; // fix uncertainty for corrupted scalers
+          if (type!=0) rec.vetoDead += 1. + 2 * fabs(*timeUncert); // matches muVeto window in skim_mjd_data
+          else if (idx==0) rec.vetoGapDead = 1. + 2 * fabs(*timeUncert);
         }
         delete vetFile;
       }
     }
     else if (dsNum==4) {
-      vector<int> muRuns, muTypes;
-      vector<double> muRunTStarts, muTimes, muUncert;
-      LoadDS4MuonList(muRuns,muRunTStarts,muTimes,muTypes,muUncert);
-
-      vector<int> idxThisRun;
-      for (size_t i = 0; i < muRuns.size(); i++)
-        if (muRuns[i]==run) idxThisRun.push_back(i);
-
-      for (size_t i = 0; i < idxThisRun.size(); i++) {
-        int muIdx = idxThisRun[i];
-        vetoDeadRun += 4 + 4. * fabs(muUncert[muIdx]); // matches muVeto window in skim_mjd_data
-        // cout << Form("Run %i  type %i  uncert %-6.4f  vetoDeadRun %-6.4f  vetoDead %-6.4f\n", run,muTypes[muIdx],muUncert[muIdx],vetoDeadRun,vetoDead);
-      }
+      pair<size_t,size_t> muThisRun = ds4Muons.RunRange(rec.run);
+      for (size_t muIdx = muThisRun.first; muIdx < muThisRun.second; muIdx++)
+        rec.vetoDead += 4 + 4. * fabs(ds4Muons.uncert[muIdx]); // matches muVeto window in skim_mjd_data
     }
-    prevStop = stop;
-    vetoDead += vetoDeadRun;
 
 
-    // Calculate LN fill deadtime.
-    int m1LNDeadRun=0, m2LNDeadRun=0;
-    // Find all fills whose veto window falls within this run.
-    vector<pair<int,int>> runFills[2];
-    for (int mod = 0; mod < 2; mod++) {
-      for (auto fill : lnFillTimes[mod])
-        if ((fill > startUnix && fill < stopUnix) ||         // fill within this run
-           (fill < startUnix && fill+hiFill > startUnix) ||  // < 5 mins before this run
-           (fill > stopUnix && fill-loFill < stopUnix)) {    // < 15 mins after this run
-           runFills[mod].push_back(make_pair(fill-loFill,fill+hiFill));
-         }
-    }
-    if (mod1 && runFills[0].size() > 0) m1LNDeadRun = mergeIntervals(runFills[0],startUnix,stopUnix);
-    if (mod2 && runFills[1].size() > 0) m2LNDeadRun = mergeIntervals(runFills[1],startUnix,stopUnix);
-    m1LNDead += (double)m1LNDeadRun;
-    m2LNDead += (double)m2LNDeadRun;
-    // if (m1LNDeadRun > 0 || m2LNDeadRun > 0)
-      // cout << Form("Found LN fill, run %i:  M1 nFills %lu  run %i  total %.0f -- M2 nFills %lu  run %i  total %.0f\n", run,runFills[0].size(),m1LNDeadRun,m1LNDead,runFills[1].size(),m2LNDeadRun,m2LNDead);
+    // Calculate LN fill deadtime: the part of this run covered by the (merged) fill veto windows.
+    if (mod1) rec.m1LNDead = (int)lnVeto[0].DeadTime(startUnix,stopUnix);
+    if (mod2) rec.m2LNDead = (int)lnVeto[1].DeadTime(startUnix,stopUnix);
 
 
-    // Calculate EACH ENABLED DETECTOR's runtime and livetime for this run, IF IT'S "GOOD".
-    // NOTES:
-    // - For each run, get a list (vector) of enabled channels.
-    //   Then use the DataSetInfo veto-only and bad lists to pop channels from the list.
-    //   Then look for a GATChannelSelectionInfo file and pop any additional channels.
-    //   We don't count the runtime OR livetime from detectors that are on these lists.
-    // - If we're applying a burst cut for this run, remove the affected channels.
-    // - If we don't have a deadtime file, report only the runtime.
-
-    MJTChannelMap *chMap = (MJTChannelMap*)bltFile->Get("ChannelMap");
-    MJTChannelSettings *chSet = (MJTChannelSettings*)bltFile->Get("ChannelSettings");
-    vector<uint32_t> enabledIDs = chSet->GetEnabledIDList();
-
-    vector<uint32_t>::iterator ite = enabledIDs.begin();
-    while (ite != enabledIDs.end()){
-      int enab = *ite;
-      GATDetInfoProcessor gp;
-      int detID = gp.GetDetIDFromName( chMap->GetString(enab, "kDetectorName") );
-      detChanToDetIDMap[enab] = detID;
-      if (detIDIsVetoOnly[detID]) { enabledIDs.erase(ite); continue; } // erase increments the iterator
-      else if (detIDIsBad[detID]) { enabledIDs.erase(ite); continue; }
-      else ++ite;
+    // Find the "good" enabled detectors for this run.
+    // - Use the DataSetInfo veto-only and bad lists to pop channels from the enabled list.
+    // - Then look for a GATChannelSelectionInfo file and pop any additional channels.
+    // The burst cut is applied in the reduction.
+    vector<uint32_t> enabledIDs;
+    map<uint32_t,int> chanDetID;
+    for (auto enab : meta->enabledIDs) {
+      int detID = gp.GetDetIDFromName( meta->detNames.at(enab) );
+      chanDetID[enab] = detID;
+      if (isFlagged(detIDIsVetoOnly,detID) || isFlagged(detIDIsBad,detID)) continue;
+      enabledIDs.push_back(enab);
     }
-
-    // Now try and load a channel selection object and pop any other bad detectors
-    // NOTE: future versions of this code should use the 'official version' argument in GetChannelSelectionPath.
-    //       but as of 9/8/17 for the 0nbb paper, that directory is empty.  If the 0nbb dataset deadtime needs
-    //       to be recalculated, this change must be made, so that the channel selection files are the same.
-    string chSelPath = GetChannelSelectionPath(dsNum,1);
-    if (FILE *file = fopen(chSelPath.c_str(), "r")) {
-      fclose(file);
-      GATChannelSelectionInfo ch_select (chSelPath, run);
+    if (useChSel) {
+      GATChannelSelectionInfo ch_select (chSelPath, rec.run);
       vector<int> DetIDList = ch_select.GetDetIDList();
       for (size_t ich=0; ich < DetIDList.size(); ich++)
       {
@@ -444,6 +761,97 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
       }
     }
 
+    // Save each good channel's deadtime file entry
+    for (auto ch : enabledIDs) {
+      RunLivetimeRecord::Channel c;
+      c.chan = ch;
+      c.detID = chanDetID[ch];
+      c.pos = meta->detPos.at(ch);
+      const double *dt = (!noDT && rec.subset >= 0) ? dtIndex.Get(rec.subset, c.pos) : NULL;
+      if (dt != NULL) {
+        c.hasDT = true;
+        for (int i = 0; i < 6; i++) c.dt[i] = dt[i];
+      }
+      rec.chans.push_back(c);
+    }
+  };
+  auto scanRuns = [&]()
+  {
+    GATDetInfoProcessor gp;
+    for (size_t i = nextRun++; i < toScan.size(); i = nextRun++)
+    {
+      size_t r = toScan[i];
+      scanRun(r, gp);
+      size_t done = nDone++;
+      if (fmod(100*(double)done/toScan.size(), 10.0) < 0.1) {
+        lock_guard<mutex> lock(coutMutex);
+        cout << 100*(double)done/toScan.size() << " % done, run " << runList[r] << endl;
+      }
+    }
+  };
+  vector<thread> workers;
+  for (int iThread = 0; iThread < nThreads; iThread++) workers.push_back(thread(scanRuns));
+  for (auto& w : workers) w.join();
+  double wall = chrono::duration<double>(chrono::steady_clock::now()-tStart).count();
+  cout << Form("Scanned %zu runs with %i thread(s) in %.1f s (%.1f runs/s).\n",
+    toScan.size(), nThreads, wall, wall > 0 ? toScan.size()/wall : 0.);
+  for (auto r : toScan)
+    if (records[r].found) ltCache.Put(records[r]);
+  ltCache.Save();
+
+
+  // ====== Add up the run records, in run order ======
+  double runTime=0, vetoRunTime=0, vetoDead=0, m1LNDead=0, m2LNDead=0;
+  map <int,double> channelRuntime, channelLivetime, channelLivetimeBest;
+  map <int,double> channelRuntimeStd2;
+  map <int,int> detChanToDetIDMap;
+  map <int,vector<double>> livetimeMap, livetimeMapBest;
+  bool firstTimeInSubset=true;     // Allows us to only add in pulser deadtime once per subset
+  double dtfRunTime=0;             // dummy runtime for deadtime fraction (hg and lg det's)
+  double dtfRunTimeBest=0;         // dummy runtime for deadtime fraction ('best' det's)
+  vector<double> dtfDeadTime(10,0); // individual deadtimes
+  time_t prevStop=0;
+  int prevSubSet=-1;
+  for (auto& rec : records)
+  {
+    int run = rec.run;
+    if (!noDT && (rec.subset != prevSubSet)) {
+      firstTimeInSubset = true;
+      prevSubSet = rec.subset;
+    }
+    if (!rec.found) {
+      cout << "Couldn't get the run info for run " << run << ".  Continuing...\n";
+      continue;
+    }
+    runTime += rec.dsRunTime;
+    if (rec.badTimes || raw) continue;
+    double thisRunTime = rec.runTime, thisRuntimeUncertainty = rec.runTimeUnc;
+
+    // Veto deadtime, plus the first veto event if there was a gap since the last run.
+    double vetoDeadRun = rec.vetoDead;
+    if (rec.vetoGapDead > 0 && (time_t)rec.vetoStart-prevStop > 10) vetoDeadRun += rec.vetoGapDead; // in case we missed a muon in a run gap
+    prevStop = rec.stop;
+    vetoRunTime += rec.vetoRunTime;
+    vetoDead += vetoDeadRun;
+
+    int m1LNDeadRun = rec.m1LNDead, m2LNDeadRun = rec.m2LNDead;
+    m1LNDead += (double)m1LNDeadRun;
+    m2LNDead += (double)m2LNDeadRun;
+
+    // Calculate EACH ENABLED DETECTOR's runtime and livetime for this run, IF IT'S "GOOD".
+    // NOTES:
+    // - The record only has channels that passed the veto-only, bad, and channel selection lists.
+    //   We don't count the runtime OR livetime from detectors that are on these lists.
+    // - If we're applying a burst cut for this run, remove the affected channels.
+    // - If we don't have a deadtime file, report only the runtime.
+    vector<uint32_t> enabledIDs;
+    map<uint32_t,const RunLivetimeRecord::Channel*> chanRec;
+    for (auto& c : rec.chans) {
+      enabledIDs.push_back(c.chan);
+      chanRec[c.chan] = &c;
+      detChanToDetIDMap[c.chan] = c.detID;
+    }
+
     // Now apply the burst cut
     if (useBurst)
     {
@@ -481,21 +889,21 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
     vector<uint32_t> bestIDs = getBestIDs(enabledIDs);
     for (auto ch : enabledIDs)
     {
-      if (detChanToDetIDMap[ch] == -1) continue;  // don't include pulser monitors.
+      const RunLivetimeRecord::Channel& c = *chanRec[ch];
+      if (c.detID == -1) continue;  // don't include pulser monitors.
 
       // Runtime
-      channelRuntime[ch] += thisRunTime; // creates new entry if one doesn't exist      
+      channelRuntime[ch] += thisRunTime; // creates new entry if one doesn't exist
       channelRuntimeStd2[ch] += (thisRuntimeUncertainty*thisRuntimeUncertainty);
-      
+
       if (noDT) continue;
 
       double thisLiveTime=0;
 
-      string pos = chMap->GetDetectorPos(ch);
-      if (dtMap.find(pos) != dtMap.end())
+      if (c.hasDT)
       {
-        double hgDead = dtMap[pos][0]/100.0; // value is in percent, divide by 100
-        double lgDead = dtMap[pos][1]/100.0;
+        double hgDead = c.dt[0]/100.0; // value is in percent, divide by 100
+        double lgDead = c.dt[1]/100.0;
 
         // Convert any negative fraction into a 1% deadtime. (David Radford says that's a safe assumption)
         if (hgDead < 0) hgDead = 0.01;
@@ -503,8 +911,8 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
 
         // The following assumes only DS2 uses presumming, and may not always be true
         // Takes out 62 or 100 us per pulser as deadtime.
-        double hgPulsers = dtMap[pos][3];
-        double lgPulsers = dtMap[pos][4];
+        double hgPulsers = c.dt[3];
+        double lgPulsers = c.dt[4];
         double hgPulserDT = hgPulsers * (dsNum==2 || dsNum==6 ? 100e-6 : 62e-6);
         double lgPulserDT = lgPulsers * (dsNum==2 || dsNum==6 ? 100e-6 : 62e-6);
 
@@ -521,17 +929,15 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
         }
       }
       else {
-        cout << "Warning: Detector " << pos << " not found! Exiting ...\n";
+        cout << "Warning: Detector " << c.pos << " not found! Exiting ...\n";
         return;
       }
       channelLivetime[ch] += thisLiveTime;
 
       // LN reduction - depends on if channel is M1 or M2
       double thisLNDeadTime = 0;
-      GATDetInfoProcessor gp;
-      int detID = gp.GetDetIDFromName( chMap->GetString(ch, "kDetectorName") );
-      if (CheckModule(detID)==1) thisLNDeadTime = m1LNDeadRun;
-      if (CheckModule(detID)==2) thisLNDeadTime = m2LNDeadRun;
+      if (CheckModule(c.detID)==1) thisLNDeadTime = m1LNDeadRun;
+      if (CheckModule(c.detID)==2) thisLNDeadTime = m2LNDeadRun;
       channelLivetime[ch] -= thisLNDeadTime;
       thisLiveTime -= thisLNDeadTime;
       dtfDeadTime[6] += thisLNDeadTime;
@@ -551,33 +957,31 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
     // Add to "Best" Livetime:  One entry per detector (loops over 'best' channel list)
     for (auto ch : bestIDs)
     {
-      if (detChanToDetIDMap[ch] == -1) continue;
+      const RunLivetimeRecord::Channel& c = *chanRec[ch];
+      if (c.detID == -1) continue;
       if (noDT) continue;
 
       double bestLiveTime = 0;
-      string pos = chMap->GetDetectorPos(ch);
-      if (dtMap.find(pos) != dtMap.end())
+      if (c.hasDT)
       {
-        double orDead = dtMap[pos][2]/100.0;
+        double orDead = c.dt[2]/100.0;
         if (orDead < 0) orDead = 0.01;
 
-        double orPulsers = dtMap[pos][5];
+        double orPulsers = c.dt[5];
         double orPulserDT = orPulsers*(dsNum==2 || dsNum==6 ? 100e-6 : 62e-6);
         bestLiveTime = thisRunTime * (1 - orDead) - orPulserDT*(firstTimeInSubset?1:0);
         dtfDeadTime[2] += thisRunTime * orDead;
         dtfDeadTime[5] += orPulserDT*(firstTimeInSubset?1:0);
       }
       else {
-        cout << "Warning: Detector " << pos << " not found! Exiting ...\n";
+        cout << "Warning: Detector " << c.pos << " not found! Exiting ...\n";
         return;
       }
       channelLivetimeBest[ch] += bestLiveTime;
 
       double thisLNDeadTime = 0;
-      GATDetInfoProcessor gp;
-      int detID = gp.GetDetIDFromName( chMap->GetString(ch, "kDetectorName") );
-      if (CheckModule(detID)==1) thisLNDeadTime = m1LNDeadRun;
-      if (CheckModule(detID)==2) thisLNDeadTime = m2LNDeadRun;
+      if (CheckModule(c.detID)==1) thisLNDeadTime = m1LNDeadRun;
+      if (CheckModule(c.detID)==2) thisLNDeadTime = m2LNDeadRun;
       channelLivetimeBest[ch] -= thisLNDeadTime;
       bestLiveTime -= thisLNDeadTime;
       dtfDeadTime[7] += thisLNDeadTime;
@@ -594,9 +998,6 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
     // Only subtract out the pulser deadtimes for each channel (for the entire subset)
     // if this is the first run in the subset.
     firstTimeInSubset = false;
-
-    // Done with this run.
-    delete bltFile;
   } // End loop over runs.
 
 
@@ -858,51 +1259,6 @@ void calculateLiveTime(vector<int> runList, int dsNum, bool raw, bool runDB, boo
 }
 
 
-int mergeIntervals(vector<pair<int,int>> vals, int start, int stop)
-{
-  // Start with a vector of start/stop intervals, and sort in order of increasing start times.
-  sort(vals.begin(), vals.end(), compareInterval);
-
-  // Start a `final` list of intervals.  Then loop over the inputs.
-  // Compare each interval to the most recent one on the stack.
-  // If the current interval doesn't overlap with the top one, push it to the stack.
-  // If the current interval DOES overlap w/ the top one, update the end time of the top one.
-  vector<pair<int,int>> merged = {vals[0]};
-  for (size_t i = 1 ; i < vals.size(); i++)
-  {
-    pair<int,int> top = merged.back();
-
-    if (top.second < vals[i].first)
-      merged.push_back(vals[i]);
-
-    else if (top.second < vals[i].second) {
-      top.second = vals[i].second;
-      merged.pop_back();
-      merged.push_back(top);
-    }
-  }
-
-  // Now that we're merged, apply a global cutoff (run boundary).
-  vector<pair<int,int>>::iterator it = merged.begin();
-  while (it != merged.end()){
-    pair<int,int> ival = *it;
-    if (ival.first < start)  { ival.first = start; *it=ival; }
-    if (ival.second > stop)  { ival.second = stop; *it=ival;}
-    if (ival.second < start || ival.first > stop) { merged.erase(it); } // erase increments the iterator
-    else it++;
-  }
-
-  // cout << "Result.  Start " << start << " ";
-  // for (auto ival : merged) cout << "[" << ival.first << "," << ival.second << "] ";
-  // cout << stop << " stop" << endl;
-
-  // Finally, sum the intervals to get the total time.
-  int deadTime = 0;
-  for (auto ival : merged) deadTime += ival.second - ival.first;
-  return deadTime;
-}
-
-
 // Used to pass multiple options to the DB as a single string.
 // http://stackoverflow.com/questions/236129/split-a-string-in-c
 template<typename Out>
@@ -1005,104 +1361,48 @@ map<int,vector<int>> LoadBurstCut()
 }
 
 
-// Looks up which sub-range a particular run is in, given a range map.
-void locateRunRange(int run, map<int,vector<string>> ranges, int& runInSet, string& dtFilePath, bool& noDT)
+// Where the per-run livetime cache for a data set lives (the same place as the run metadata cache).
+string getLivetimeCachePath(int dsNum)
 {
-  bool foundRun = false;
-  for (auto& r : ranges) {
-    vector<string> thisRange = r.second; // c++ map trick: the first string is the file path, the rest are the run ranges.
-    dtFilePath = thisRange[0];
-
-    for (size_t i = 1; i < thisRange.size(); i+=2) {
-      if (run >= stoi(thisRange[i]) && run <= stoi(thisRange[i+1])) {
-        // cout << Form("Found run %i between runs %i and %i\n",run,stoi(thisRange[i]),stoi(thisRange[i+1]));
-        foundRun = true;
-        runInSet = r.first;
-        break;
-      }
-    }
-    if (foundRun) break;
-  }
-  if (!foundRun) {
-    if (!noDT) cout << "Couldn't find deadtime file for run " << run << ". Reverting to runtime-only calculation ...\n";
-    runInSet = -1;
-    noDT = true;
-  }
+  string dir = GetRunMetaCacheDir();
+  return (dir == "") ? "" : dir + "/runLivetimeDS" + to_string(dsNum) + ".bin";
 }
 
-// Parses the 'lis' files in ./deadtime/ to make a range map.
-// The first string is the file path, the rest are the 'int' run ranges.
-map<int, vector<string>> getDeadtimeMap(int dsNum, bool& noDT, int dsNum_hi)
+// Path, modification time, and size of a file, or an empty string if it doesn't exist.
+string fileVersion(string path)
 {
-  map<int, vector<string>> ranges;
-
-  // Load ranges for one ds or a range of DS's.
-  vector<int> dsList;
-  if (dsNum_hi == -1) dsList = {dsNum};
-  else
-    for (int i = dsNum; i <= dsNum_hi; i++)
-      dsList.push_back(i);
-
-  int rangeCount = 0;
-  for (auto ds : dsList)
-  {
-    // Find runlist files for this dataset
-    string command = Form("ls ./deadtime/ds%i_*.lis",ds);
-    if (ds==5) command = Form("ls ./deadtime/DS*.lis");
-    array<char, 128> buffer;
-    vector<string> files;
-    string str;
-    shared_ptr<FILE> pipe(popen(command.c_str(), "r"), pclose);
-    if (!pipe) throw runtime_error("popen() failed!");
-    while (!feof(pipe.get())) {
-      if (fgets(buffer.data(), 128, pipe.get()) != NULL) {
-        str = buffer.data();
-        str.erase(remove(str.begin(), str.end(), '\n'), str.end());  // strip newline
-        files.push_back(str);
-      }
-    }
-
-    // If we didn't find any files, set noDT = true and return.
-    if (files.size()==0) {
-      noDT=1;
-      return ranges;
-    }
-
-    // Build the ranges.  Quit at the first sign of trouble.
-    for (auto file : files)
-    {
-      // cout << file << endl;
-      ifstream lisFile(file.c_str());
-      if (!lisFile) {
-        cout << "Couldn't find file: " << file << endl;
-        return ranges;
-      }
-      string buffer;
-      int firstRun = -1, lastRun = -1;
-      while (getline(lisFile, buffer))
-      {
-        size_t found = buffer.find("Run");
-        if (found == string::npos) {
-          cout << "Couldn't find a run expression in " << buffer << endl;
-          return ranges;
-        }
-        int run = stoi( buffer.substr(found+3) );
-        if (firstRun == -1) firstRun = run;
-        lastRun = run;
-      }
+  struct stat st;
+  if (path == "" || stat(path.c_str(), &st) != 0) return "";
+  return Form("%s:%lld:%lld", path.c_str(), (long long)st.st_mtime, (long long)st.st_size);
+}
 
-      // grab the corresponding DT file
-      string dtFile = file.substr(0, file.find_last_of(".")) + ".DT";
+// fileVersion of every file in a directory, in name order.  GATChannelSelectionInfo picks each
+// run's file out of the channel selection directory, so this changes when any of them does.
+string dirVersion(string path)
+{
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) return fileVersion(path);
+  vector<string> names;
+  while (struct dirent *ent = readdir(dir))
+    if (ent->d_name[0] != '.') names.push_back(ent->d_name);
+  closedir(dir);
+  sort(names.begin(), names.end());
+  string version;
+  for (auto& name : names) version += fileVersion(path + "/" + name) + ";";
+  return version;
+}
 
-      // Fill the range map
-      ranges[rangeCount] = {dtFile,to_string(firstRun),to_string(lastRun)};
-      rangeCount++;
-    }
+// 64-bit FNV-1a hash, used for the livetime cache keys.  Pass the last result as h to chain calls.
+uint64_t hashBytes(const void* data, size_t n, uint64_t h)
+{
+  const unsigned char* p = (const unsigned char*)data;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
   }
-  return ranges;
+  return h;
 }
 
-
 double getTotalLivetimeUncertainty(map<int, double> livetimes, string opt)
 {
   double sum_x = 0;
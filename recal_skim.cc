@@ -0,0 +1,205 @@
+// recal_skim.cc
+// Recompute the calibration-dependent columns of an existing skim file
+// (trapENFCalC, trapENMCalC, avse, and the DCR's) with the current parameters,
+// without rerunning the skim.  Each run's hits are read into one column block
+// and computed at once with RunCalibration::ComputeColumns.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TTree.h"
+#include "GATDataSet.hh"
+#include "DataSetInfo.hh"
+
+using namespace std;
+
+// The hits of one run, in skim entry order.
+struct RunBlock
+{
+  int run;
+  vector<int> iEvent;        // one per skim entry: the entry in the run's mjdTree
+  vector<size_t> entryStart; // one per skim entry: its first hit in the block
+  vector<int> iHit;          // one per hit: the hit index in the gatified event
+  vector<int> gatChannel;    // scratch space, for checking the gatified file against the skim
+  HitColumns hits;
+
+  size_t EntryEnd(size_t e) const { return (e+1 < entryStart.size()) ? entryStart[e+1] : hits.Size(); }
+};
+
+bool ReadGatInputs(RunBlock& b);
+
+int main(int argc, const char** argv)
+{
+  if (argc < 3 || argc > 4) {
+    cout << "Usage:  ./recal_skim [-n] [input skim file] [output skim file]\n"
+         << "Recomputes trapENFCalC, trapENMCalC, avse and the DCR's with the current parameters.\n"
+         << "   [-n] (don't open the gatified files.  AvsE needs TSCurrent and trapENF, which aren't\n"
+         << "         in skim files, so avse is copied over unchanged.) \n";
+    return 1;
+  }
+  bool noGat = false;
+  vector<string> opt(argv + 1, argv + argc);
+  if (opt[0] == "-n") {
+    noGat = true;
+    opt.erase(opt.begin());
+    cout << "Not reading gatified files, avse will be copied unchanged.\n";
+  }
+  if (opt.size() != 2 || opt[0] == opt[1]) {
+    cout << "Error: need an input skim file and a different output file.\n";
+    return 1;
+  }
+  string inFile = opt[0], outFile = opt[1];
+
+  TFile *fIn = TFile::Open(inFile.c_str(), "READ");
+  TTree *skimTree = (fIn == NULL) ? NULL : (TTree*)fIn->Get("skimTree");
+  if (skimTree == NULL) {
+    cout << "Error: can't read skimTree from " << inFile << endl;
+    return 1;
+  }
+  vector<string> inputs = {"run", "iEvent", "iHit", "channel", "trapENFCal", "trapENMCal", "nlcblrwfSlope"};
+  for (auto& name : inputs)
+    if (skimTree->GetBranch(name.c_str()) == NULL) {
+      cout << "Error: " << inFile << " has no " << name << " branch.\n";
+      return 1;
+    }
+
+  // ==========================================================================
+  // Pass 1: gather every hit's inputs, one column block per run.
+  vector<RunBlock> blocks;
+  int run = 0, iEvent = 0;
+  vector<int> *iHit = NULL, *channel = NULL;
+  vector<double> *trapENFCal = NULL, *trapENMCal = NULL, *nlcblrwfSlope = NULL;
+  skimTree->SetBranchStatus("*",0);
+  for (auto& name : inputs) skimTree->SetBranchStatus(name.c_str(),1);
+  skimTree->SetBranchAddress("run", &run);
+  skimTree->SetBranchAddress("iEvent", &iEvent);
+  skimTree->SetBranchAddress("iHit", &iHit);
+  skimTree->SetBranchAddress("channel", &channel);
+  skimTree->SetBranchAddress("trapENFCal", &trapENFCal);
+  skimTree->SetBranchAddress("trapENMCal", &trapENMCal);
+  skimTree->SetBranchAddress("nlcblrwfSlope", &nlcblrwfSlope);
+  Long64_t nEntries = skimTree->GetEntries();
+  for (Long64_t ient = 0; ient < nEntries; ient++)
+  {
+    skimTree->GetEntry(ient);
+    if (blocks.empty() || blocks.back().run != run) {
+      blocks.push_back(RunBlock());
+      blocks.back().run = run;
+    }
+    RunBlock& b = blocks.back();
+    b.iEvent.push_back(iEvent);
+    b.entryStart.push_back(b.hits.Size());
+    for (size_t i = 0; i < channel->size(); i++) {
+      b.hits.Push((*channel)[i], 0, (*trapENFCal)[i], (*trapENMCal)[i], 0, 0, 0, (*nlcblrwfSlope)[i]);
+      b.iHit.push_back((*iHit)[i]);
+    }
+  }
+  skimTree->ResetBranchAddresses();
+  skimTree->SetBranchStatus("*",1);
+  delete iHit; delete channel; delete trapENFCal; delete trapENMCal; delete nlcblrwfSlope;
+  cout << "Read " << nEntries << " entries from " << blocks.size() << " runs.\n";
+
+  // ==========================================================================
+  // Recompute each run's columns
+  RunCalibration runCal;
+  for (auto& b : blocks)
+  {
+    if (!noGat && !ReadGatInputs(b)) return 1;
+    int dsNum = FindDataSet(b.run);
+    if (dsNum == -1) return 1;
+    runCal.Load(dsNum, b.run);
+    runCal.ComputeColumns(b.hits);
+  }
+
+  // ==========================================================================
+  // Pass 2: copy the tree, with the recomputed columns swapped in.
+  // The clone shares the input tree's buffers for every other branch.
+  struct Column { const char* name; vector<double> HitColumns::*col; vector<double> val, *addr; };
+  vector<Column> cols = {
+    {"trapENFCalC", &HitColumns::trapENFCalC}, {"trapENMCalC", &HitColumns::trapENMCalC},
+    {"avse", &HitColumns::avse}, {"dcrctc90", &HitColumns::dcrctc90}, {"dcr85", &HitColumns::dcr85},
+    {"dcr90", &HitColumns::dcr90}, {"dcr95", &HitColumns::dcr95}, {"dcr98", &HitColumns::dcr98},
+    {"dcr99", &HitColumns::dcr99}, {"dcr995", &HitColumns::dcr995}, {"dcr999", &HitColumns::dcr999}
+  };
+  TFile *fOut = TFile::Open(outFile.c_str(), "recreate");
+  if (fOut == NULL || fOut->IsZombie()) {
+    cout << "Error: can't create " << outFile << endl;
+    return 1;
+  }
+  TTree *outTree = skimTree->CloneTree(0);
+  vector<Column*> used;
+  for (auto& c : cols) {
+    if (outTree->GetBranch(c.name) == NULL || (noGat && string(c.name) == "avse")) continue;
+    c.addr = &c.val;
+    outTree->SetBranchAddress(c.name, &c.addr);
+    used.push_back(&c);
+  }
+  size_t iBlock = 0, iEnt = 0;
+  for (Long64_t ient = 0; ient < nEntries; ient++)
+  {
+    skimTree->GetEntry(ient);
+    const RunBlock& b = blocks[iBlock];
+    size_t lo = b.entryStart[iEnt], hi = b.EntryEnd(iEnt);
+    for (auto c : used) {
+      const vector<double>& v = b.hits.*(c->col);
+      c->val.assign(v.begin()+lo, v.begin()+hi);
+    }
+    outTree->Fill();
+    if (++iEnt == b.entryStart.size()) iBlock++, iEnt = 0;
+  }
+  outTree->Write("", TObject::kOverwrite);
+
+  // Keep the pulser timeline, if the skim has one
+  TTree *pulserTree = (TTree*)fIn->Get("pulserTree");
+  if (pulserTree != NULL) {
+    fOut->cd();
+    TTree *outPulser = pulserTree->CloneTree(-1, "fast");
+    outPulser->Write("", TObject::kOverwrite);
+  }
+  cout << outTree->GetEntries() << " entries written to " << outFile << endl;
+  fOut->Close();
+  fIn->Close();
+  return 0;
+}
+
+// Fill in the block's trapENF and TSCurrent maxima from the run's gatified file,
+// using the skim's iEvent (entry in the run's mjdTree) and iHit indexes.
+bool ReadGatInputs(RunBlock& b)
+{
+  GATDataSet ds;
+  string gatPath = ds.GetPathToRun(b.run, GATDataSet::kGatified);
+  TFile *fGat = TFile::Open(gatPath.c_str(), "READ");
+  TTree *gatTree = (fGat == NULL) ? NULL : (TTree*)fGat->Get("mjdTree");
+  if (gatTree == NULL) {
+    cout << "Error: can't read mjdTree for run " << b.run << " from " << gatPath << endl;
+    if (fGat != NULL) fGat->Close();
+    return false;
+  }
+  vector<double> *chan = NULL, *enf = NULL, *a50 = NULL, *a100 = NULL, *a200 = NULL;
+  const char* names[] = {"channel", "trapENF", "TSCurrent50nsMax", "TSCurrent100nsMax", "TSCurrent200nsMax"};
+  vector<double> **addrs[] = {&chan, &enf, &a50, &a100, &a200};
+  gatTree->SetBranchStatus("*",0);
+  for (int j = 0; j < 5; j++) {
+    gatTree->SetBranchStatus(names[j],1);
+    gatTree->SetBranchAddress(names[j], addrs[j]);
+  }
+  bool ok = true;
+  for (size_t e = 0; e < b.iEvent.size() && ok; e++)
+  {
+    if (gatTree->GetEntry(b.iEvent[e]) <= 0) ok = false;
+    for (size_t k = b.entryStart[e]; k < b.EntryEnd(e) && ok; k++) {
+      size_t i = b.iHit[k];
+      if (i >= chan->size() || (int)(*chan)[i] != b.hits.channel[k]) { ok = false; break; }
+      b.hits.trapENF[k] = (*enf)[i];
+      b.hits.tsCurrent50nsMax[k] = (*a50)[i];
+      b.hits.tsCurrent100nsMax[k] = (*a100)[i];
+      b.hits.tsCurrent200nsMax[k] = (*a200)[i];
+    }
+    if (!ok) cout << Form("Error: %s doesn't match the skim at entry %i.  Was it reprocessed?\n",
+      gatPath.c_str(), b.iEvent[e]);
+  }
+  fGat->Close();
+  delete chan; delete enf; delete a50; delete a100; delete a200;
+  return ok;
+}
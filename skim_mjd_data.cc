@@ -1,10 +1,15 @@
 #include <iostream>
 #include <string>
+#include <cstdio>
 #include <map>
 #include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <bitset>
+#include <memory>
+#include <fstream>
 #include "TFile.h"
 #include "TTree.h"
 #include "TList.h"
@@ -40,9 +45,194 @@ using namespace CLHEP;
 
 vector<int> getBestIDs(vector<int> input);
 
+struct SkimCheckpoint { int run; Long64_t entries; long long fileSize, fileMTime; };
+vector<SkimCheckpoint> readCheckpoints(string path);
+void writeCheckpoints(string path, const vector<SkimCheckpoint>& ckpts, bool append=false);
+SkimCheckpoint makeCheckpoint(int run, Long64_t entries);
+bool sameInput(const SkimCheckpoint& a, const SkimCheckpoint& b);
+Long64_t skimEntries(string path);
+vector<int> addC0(vector<int> c0, const vector<int>& more);
+void writeC0List(string path, const vector<int>& c0);
+vector<int> readC0List(string path);
+Long64_t copyC0Entries(TTree *in, TTree *&out, const vector<int>& before);
+bool rewriteC0(string shard, const vector<int>& before);
+
+// ==========================================================================
+// Skim branch schema.  One row per gatified input and/or skim output branch,
+// and which skims include it:
+//   kSkimAll:  every skim file
+//   kSkimFull: not in minimal (-m) skim files
+//   kSkimLow:  only in low-energy (-l) skim files
+//   kSkimCut:  input is needed for the hit selection, even if its output isn't written
+// Inputs are only read (and only decompressed) if the chosen skim needs them.
+enum { kSkimAll=0x1, kSkimFull=0x2, kSkimLow=0x4, kSkimCut=0x8 };
+
+struct SkimSchema
+{
+  struct Row { const char* input; const char* output; int modes; };
+  vector<Row> rows;
+  bool smallOutput, lowEnergy;
+
+  SkimSchema(bool small, bool low) : smallOutput(small), lowEnergy(low)
+  {
+    rows = {
+      // run level variables & indices
+      {"",               "skimgatrev",       kSkimAll},
+      {"gatrev",         "gatrev",           kSkimAll},
+      {"run",            "run",              kSkimAll},
+      {"",               "iEvent",           kSkimAll},
+      {"",               "iHit",             kSkimAll},
+      // ID variables
+      {"channel",        "channel",          kSkimAll},
+      {"P",              "P",                kSkimAll},
+      {"D",              "D",                kSkimAll},
+      {"C",              "C",                kSkimAll},
+      {"",               "gain",             kSkimAll},
+      {"mageID",         "mageID",           kSkimAll},
+      {"detID",          "detID",            kSkimAll},
+      {"detName",        "detName",          kSkimAll},
+      {"",               "isEnr",            kSkimAll},
+      {"",               "isNat",            kSkimAll},
+      {"",               "isGood",           kSkimAll},
+      {"",               "c0Channels",       kSkimAll},
+      // time variables
+      {"startTime",      "startTime_s",      kSkimAll},
+      {"",               "startTime0_s",     kSkimAll},
+      {"",               "runTime_s",        kSkimAll},
+      {"stopTime",       "stopTime_s",       kSkimAll},
+      {"startClockTime", "startClockTime_s", kSkimAll},
+      {"clockTime",      "clockTime_s",      kSkimAll},
+      {"localTime",      "localTime_s",      kSkimAll},
+      {"globalTime",     "globalTime",       kSkimAll},
+      {"tOffset",        "tOffset",          kSkimAll},
+      {"triggerTrapt0",  "triggerTrapt0",    kSkimAll},
+      {"",               "dtPulserGlobal",   kSkimAll},
+      {"",               "dtPulserCard",     kSkimAll},
+      {"trapENMSample",  "trapENMSample",    kSkimLow},
+      {"blrwfFMR50",     "blrwfFMR50",       kSkimLow},
+      // energy variables
+      {"trapENFCal",     "trapENFCal",       kSkimAll},
+      {"trapENMCal",     "trapENMCal",       kSkimAll},
+      {"",               "trapENFCalC",      kSkimAll},
+      {"",               "trapENMCalC",      kSkimAll},
+      {"trapECal",       "trapECal",         kSkimFull | kSkimCut},
+      {"energy",         "onBoardE",         kSkimFull},
+      {"trapENF",        "trapENF",          kSkimLow | kSkimCut},
+      {"trapENM",        "trapENM",          kSkimLow},
+      {"",               "sumEHL",           kSkimAll},
+      {"",               "sumEH",            kSkimAll},
+      {"",               "sumEL",            kSkimAll},
+      {"",               "sumEHClean",       kSkimAll},
+      {"",               "sumELClean",       kSkimAll},
+      // granularity variables
+      {"",               "mHL",              kSkimAll},
+      {"",               "mH",               kSkimAll},
+      {"",               "mL",               kSkimAll},
+      {"",               "mHClean",          kSkimAll},
+      {"",               "mLClean",          kSkimAll},
+      // pulse shape variables
+      {"TSCurrent50nsMax",  "",              kSkimAll},
+      {"TSCurrent100nsMax", "",              kSkimAll},
+      {"TSCurrent200nsMax", "",              kSkimAll},
+      {"",               "avse",             kSkimAll},
+      {"nlcblrwfSlope",  "nlcblrwfSlope",    kSkimAll},
+      {"",               "dcr99",            kSkimAll},
+      {"",               "dcr95",            kSkimAll},
+      {"",               "dcr90",            kSkimAll},
+      {"",               "dcrctc90",         kSkimAll},
+      {"trapETailMin",   "trapETailMin",     kSkimFull},
+      {"triTrapMax",     "kvorrT",           kSkimFull},
+      {"",               "dcr85",            kSkimFull},
+      {"",               "dcr98",            kSkimFull},
+      {"",               "dcr995",           kSkimFull},
+      {"",               "dcr999",           kSkimFull},
+      {"RawWFblSlope",   "RawWFblSlope",     kSkimLow},
+      {"RawWFblChi2",    "RawWFblChi2",      kSkimLow},
+      // LN tag variables
+      {"",               "isLNFill1",        kSkimAll},
+      {"",               "isLNFill2",        kSkimAll},
+      // data cleaning variables
+      {"EventDC1Bits",   "EventDC1Bits",     kSkimAll},
+      {"wfDCBits",       "wfDCBits",         kSkimAll},
+      {"rawWFMin",       "",                 kSkimAll},
+      {"d2wfnoiseTagNorm", "d2wfnoiseTagNorm", kSkimAll},
+      {"fastTrapNLCWFsnRisingX", "nX",       kSkimAll},
+      {"nFlippedBits",   "nFlippedBits",     kSkimAll},
+      {"d2wf5MHzTo30MHzPower",  "d2wf5MHzTo30MHzPower",  kSkimLow},
+      {"d2wf30MHzTo35MHzPower", "d2wf30MHzTo35MHzPower", kSkimLow},
+      {"d2wf0MHzTo50MHzPower",  "d2wf0MHzTo50MHzPower",  kSkimLow},
+      {"threshKeV",      "threshKeV",        kSkimLow},
+      {"threshSigma",    "threshSigma",      kSkimLow},
+      // muon veto variables
+      {"",               "dtmu_s",           kSkimAll},
+      {"",               "muType",           kSkimAll},
+      {"",               "muTUnc",           kSkimAll},
+      {"",               "muVeto",           kSkimAll},
+      // detector mass data
+      {"",               "mAct_g",           kSkimAll},
+      {"",               "mAct_M1Total_kg",  kSkimAll},
+      {"",               "mAct_M1enr_kg",    kSkimAll},
+      {"",               "mAct_M1nat_kg",    kSkimAll},
+      {"",               "mAct_M2Total_kg",  kSkimAll},
+      {"",               "mAct_M2enr_kg",    kSkimAll},
+      {"",               "mAct_M2nat_kg",    kSkimAll},
+      {"",               "mVeto_M1Total_kg", kSkimAll},
+      {"",               "mVeto_M2Total_kg", kSkimAll}
+    };
+  }
+
+  bool InSkim(int modes) const {
+    return (modes & kSkimAll) || (!smallOutput && (modes & kSkimFull)) || (lowEnergy && (modes & kSkimLow));
+  }
+
+  bool Reads(string input) const {
+    for (auto& r : rows)
+      if (input == r.input) return InSkim(r.modes) || (r.modes & kSkimCut);
+    return false;
+  }
+
+  bool Writes(string output) const {
+    for (auto& r : rows)
+      if (output == r.output) return InSkim(r.modes);
+    cout << "SkimSchema: output branch " << output << " isn't in the schema, not writing it.\n";
+    return false;
+  }
+
+  // Turn off every input branch this skim doesn't read.
+  void EnableInputs(TChain *ch) const
+  {
+    ch->SetBranchStatus("*",0);
+    for (auto& r : rows) {
+      if (string(r.input) == "" || !Reads(r.input)) continue;
+      TBranch *br = ch->GetBranch(r.input);
+      if (br == NULL) continue;
+      ch->SetBranchStatus(r.input,1);
+      if (br->GetListOfBranches()->GetEntries() > 0) ch->SetBranchStatus(Form("%s.*",r.input),1); // split objects
+    }
+  }
+
+  template<typename T> void Branch(TTree *tree, const char* output, T *addr) const {
+    if (Writes(output)) tree->Branch(output, addr);
+  }
+  template<typename T> void Branch(TTree *tree, const char* output, T *addr, const char* leaves) const {
+    if (Writes(output)) tree->Branch(output, addr, leaves);
+  }
+};
+
+// A TTreeReaderValue that is only created if the schema reads its branch.
+template<typename T> class SkimReader
+{
+  unique_ptr< TTreeReaderValue<T> > val;
+public:
+  SkimReader(TTreeReader &reader, const SkimSchema &schema, const char* input) {
+    if (schema.Reads(input)) val.reset(new TTreeReaderValue<T>(reader, input));
+  }
+  T& operator*() { return **val; }
+};
+
 int main(int argc, const char** argv)
 {
-  if (argc < 3 || argc > 8) {
+  if (argc < 3 || argc > 13) {
     cout << "Usage:  ./skim_mjd_data [options] [output path (optional)]\n"
          << " -- Single run:   ./skim_mjd_data -f [runNum] \n"
          << " -- Custom file:  ./skim_mjd_data --filename [file] [runNum]\n"
@@ -51,16 +241,20 @@ int main(int argc, const char** argv)
          << "   [-m] (minimal skim file - use for calibrations etc.) \n"
          << "   [-l] (low energy skim file - additional parameters) \n"
          << "   [-n] (LG event skipping - set this to turn ON.) \n"
-         << "   [-t] [number] (custom energy threshold - default is 2 keV) \n";
+         << "   [-t] [number] (custom energy threshold - default is 2 keV) \n"
+         << "   [-j] [number] (split a data set's runs between N worker processes) \n"
+         << "   [-p] (also write each card's pulser times to a pulserTree) \n"
+         << "   [-r] (resumable: checkpoint each run, and on restart only skim new or unfinished runs) \n"
+         << "   [-s] (sharded: one file per run in [output]_shards/, plus an index.txt) \n";
     return 1;
   }
   // ==========================================================================
   // Get user arguments
-  GATDataSet ds;
+  GATDataSet dsAll;
   TChain *gatChain=NULL, *vetoChain=NULL;
   string outputPath = "";
-  int dsNum = -1, subRun = -1;
-  bool smallOutput=0, simulatedInput=0, singleFile=0, lowEnergy=0, noSkip=1;
+  int dsNum = -1, subRun = -1, nWorkers = 1;
+  bool smallOutput=0, simulatedInput=0, singleFile=0, lowEnergy=0, noSkip=1, pulserTimeline=0, resume=0, shardOutput=0;
   double energyThresh = 5; // keV
   vector<string> opt(argv + 1, argv + argc);
   for (size_t i = 0; i < opt.size(); i++)
@@ -68,18 +262,26 @@ int main(int argc, const char** argv)
     if (opt[i] == "-m") { smallOutput=1;    cout << "Minimal skim file selected. \n"; }
     if (opt[i] == "-l") { lowEnergy=1;      cout << "Augmented low-energy selected. \n"; }
     if (opt[i] == "-n") { noSkip=0;         cout << "No LG-skip option deactivated. \n"; }
+    if (opt[i] == "-p") { pulserTimeline=1; cout << "Writing pulser timeline. \n"; }
+    if (opt[i] == "-r") { resume=1;         cout << "Resumable skim selected. \n"; }
+    if (opt[i] == "-s") { shardOutput=1;    cout << "Sharded (one file per run) output selected. \n"; }
     if (opt[i] == "-t") {
       energyThresh = stod(opt[i+1]);
       opt.erase(opt.begin()+i+1);
       cout << "Set HG energy threshold to " << energyThresh << " keV\n";
     }
+    if (opt[i] == "-j") {
+      nWorkers = stoi(opt[i+1]);
+      opt.erase(opt.begin()+i+1);
+      cout << "Using " << nWorkers << " worker processes.\n";
+    }
     if (opt[i] == "-f") {  // single run
       singleFile=1;
       subRun = stoi(opt[i+1]);
       opt.erase(opt.begin()+i+1);
       dsNum = FindDataSet(subRun);
       if (dsNum==-1) return 1;
-      ds.AddRunNumber(subRun);
+      dsAll.AddRunNumber(subRun);
     }
     if (opt[i] == "--filename") {  // custom file
       singleFile=1;
@@ -92,7 +294,7 @@ int main(int argc, const char** argv)
       gatChain = new TChain("mjdTree","mjdTree");
       gatChain->AddFile(fileName.c_str());
       vetoChain = new TChain("vetoTree","vetoTree");
-      string vetoPath = ds.GetPathToRun(subRun,GATDataSet::kVeto);
+      string vetoPath = dsAll.GetPathToRun(subRun,GATDataSet::kVeto);
       vetoChain->Add(vetoPath.c_str());
     }
     if (isdigit((opt[i].c_str())[0])) {  // dataset sub-range
@@ -100,7 +302,7 @@ int main(int argc, const char** argv)
       subRun = stoi(opt[i+1]);
       opt.erase(opt.begin()+i+1, opt.begin()+i+2);
       cout << Form("Loading dataset %i run sequence %i\n",dsNum,subRun);
-      LoadDataSet(ds, dsNum, subRun);
+      LoadDataSet(dsAll, dsNum, subRun);
     }
   }
   // Set outputPath only if last arg is a valid system path
@@ -112,6 +314,191 @@ int main(int argc, const char** argv)
     cout << "Writing to output directory: " << tmp << endl;
   }
 
+  // Output file name
+  string outputFile = Form("skimDS%i",dsNum);
+  if (singleFile) outputFile += Form("_run%i",subRun);
+  else outputFile += Form("_%i",subRun);
+  if (smallOutput) outputFile += "_small";
+  if (lowEnergy) outputFile += "_low";
+  string outputBase = outputFile;
+  outputFile += ".root";
+  cout << outputFile << endl;
+  if (outputPath != "") {
+    outputFile = outputPath + "/" + outputFile;
+    outputBase = outputPath + "/" + outputBase;
+  }
+
+  // Sharded mode (-s): each run is written to its own file, and index.txt lists them.
+  // Use SkimShards (DataSetInfo.hh) to read them back as one chain.
+  string shardDir = outputBase + "_shards";
+  if (shardOutput) {
+    mkdir(shardDir.c_str(), 0755);
+    cout << "Writing run shards to " << shardDir << endl;
+  }
+
+  // ==========================================================================
+  // Resumable mode (-r): after each run, record it in a checkpoint file next to the output,
+  // along with the skimTree entry count and the size and time of its gatified file.
+  // On restart, runs at the start of the list that are checkpointed and unchanged are kept
+  // (their entries are copied from the old output), and skimming picks up at the next run.
+  // New runs added to a LoadDataSet range are picked up the same way.
+  size_t nRunsAll = dsAll.GetNRuns(), nDone = 0;
+  string ckptPath = outputBase + ".ckpt", oldOutputFile = outputFile + ".old";
+  Long64_t nKeep = 0;
+  if (resume)
+  {
+    if (singleFile || nWorkers > 1 || pulserTimeline || shardOutput) {
+      cout << "Error: -r only works on data set ranges, and can't be combined with -j, -p or -s.\n";
+      return 1;
+    }
+    vector<SkimCheckpoint> ckpts = readCheckpoints(ckptPath);
+    while (nDone < ckpts.size() && nDone < nRunsAll && ckpts[nDone].run == (int)dsAll.GetRunNumber(nDone)
+      && sameInput(ckpts[nDone], makeCheckpoint(ckpts[nDone].run, 0)))
+      nDone++;
+    if (nDone > 0) nKeep = ckpts[nDone-1].entries;
+
+    // Make sure the old output really has those entries.
+    // If an earlier resumed job died before its first checkpoint (e.g. while copying the
+    // finished runs), the output is missing or short, but the runs are still in the .old file.
+    bool fromOld = false;
+    if (nDone > 0 && skimEntries(outputFile) < nKeep) {
+      Long64_t nOld = skimEntries(oldOutputFile);
+      while (nDone > 0 && ckpts[nDone-1].entries > nOld) nDone--;
+      nKeep = (nDone > 0) ? ckpts[nDone-1].entries : 0;
+      if (nDone > 0) {
+        fromOld = true;
+        cout << "Output is incomplete, recovering the finished runs from " << oldOutputFile << endl;
+      }
+      else cout << "Checkpoint doesn't match " << outputFile << ", starting over.\n";
+    }
+    // The output is rebuilt from the .old file by the skim itself, so it needs a run to skim
+    if (nDone == nRunsAll && fromOld) {
+      nDone--;
+      nKeep = (nDone > 0) ? ckpts[nDone-1].entries : 0;
+    }
+    if (nDone == nRunsAll) {
+      cout << "All " << nRunsAll << " runs are already skimmed.\n";
+      return 0;
+    }
+    if (nDone > 0) {
+      cout << Form("Resuming: keeping %i runs (%lli entries), skimming from run %i\n",
+        (int)nDone, nKeep, (int)dsAll.GetRunNumber(nDone));
+      if (!fromOld) rename(outputFile.c_str(), oldOutputFile.c_str());
+    }
+    ckpts.resize(nDone);
+    writeCheckpoints(ckptPath, ckpts);
+  }
+
+  // ==========================================================================
+  // Parallel mode (-j): fork one worker process for each contiguous block of runs.
+  // Each worker also reads the run just before its block (without saving it),
+  // so the muon list, pulser times, etc. start out the same as in a serial skim.
+  // The parent waits for the workers and merges their files in run order.
+  GATDataSet ds;
+  int workerID = -1, primerRun = -1;
+  if (nWorkers > 1 && !singleFile && nRunsAll > 1)
+  {
+    if (nWorkers > (int)nRunsAll) nWorkers = nRunsAll;
+
+    // Fill the run metadata cache for every run before forking.  The workers only read it:
+    // two workers saving it at once could each drop the runs the other one added.
+    RunMetaCache metaCache(GetRunMetaCachePath(dsNum));
+    for (size_t i = 0; i < nRunsAll; i++)
+      if (metaCache.Get(dsAll.GetRunNumber(i)) == NULL) return 1;
+    metaCache.Save();
+
+    cout << flush;
+    vector<pid_t> workers;
+    for (int w = 0; w < nWorkers; w++) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        cout << "Error: fork() failed for worker " << w << endl;
+        return 1;
+      }
+      if (pid == 0) { workerID = w; break; }
+      workers.push_back(pid);
+    }
+    if (workerID == -1)
+    {
+      bool failed = false;
+      for (auto pid : workers) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = true;
+      }
+      if (failed) {
+        cout << "Error: a worker failed.  Leaving its part files in place.\n";
+        return 1;
+      }
+
+      // c0Channels accumulates over the whole skim, but each worker only saw its own block.
+      // Get the cryostat-0 channels seen before each block from the workers' final lists.
+      vector< vector<int> > c0Before(nWorkers);
+      bool fixC0 = false;
+      for (int w = 1; w < nWorkers; w++) {
+        c0Before[w] = addC0(c0Before[w-1], readC0List(Form("%s_part%i.c0",outputBase.c_str(),w-1)));
+        if (!c0Before[w].empty()) fixC0 = true;
+      }
+      for (int w = 0; w < nWorkers; w++) remove(Form("%s_part%i.c0",outputBase.c_str(),w));
+
+      if (shardOutput) {
+        for (int w = 1; w < nWorkers && fixC0; w++) {
+          size_t lo = w * nRunsAll / nWorkers, hi = (w+1) * nRunsAll / nWorkers;
+          for (size_t i = lo; i < hi && !c0Before[w].empty(); i++)
+            if (!rewriteC0(SkimShards::ShardFile(shardDir, (int)dsAll.GetRunNumber(i)), c0Before[w])) return 1;
+        }
+        SkimShards::WriteIndex(shardDir);
+        cout << "Wrote " << shardDir << "/index.txt\n";
+        return 0;
+      }
+      cout << "Merging " << nWorkers << " worker files into " << outputFile << endl;
+      TChain parts("skimTree");
+      for (int w = 0; w < nWorkers; w++) parts.Add(Form("%s_part%i.root",outputBase.c_str(),w));
+      if (!fixC0) parts.Merge(outputFile.c_str(),"fast");
+      else {
+        // Copy entry by entry, putting the earlier blocks' channels back into c0Channels
+        TFile *fMerged = TFile::Open(outputFile.c_str(), "recreate");
+        TTree *merged = NULL;
+        for (int w = 0; w < nWorkers; w++) {
+          TFile *fPart = TFile::Open(Form("%s_part%i.root",outputBase.c_str(),w), "READ");
+          fMerged->cd();
+          copyC0Entries((TTree*)fPart->Get("skimTree"), merged, c0Before[w]);
+          fPart->Close();
+        }
+        fMerged->cd();
+        merged->Write("", TObject::kOverwrite);
+        fMerged->Close();
+      }
+      if (pulserTimeline) {
+        TChain pulserParts("pulserTree");
+        for (int w = 0; w < nWorkers; w++) pulserParts.Add(Form("%s_part%i.root",outputBase.c_str(),w));
+        TFile *fMerged = TFile::Open(outputFile.c_str(), "update");
+        pulserParts.Merge(fMerged, 0, "fast keep");
+        fMerged->Close();
+      }
+      for (int w = 0; w < nWorkers; w++) remove(Form("%s_part%i.root",outputBase.c_str(),w));
+      cout << parts.GetEntries() << " entries saved.\n";
+      return 0;
+    }
+    size_t lo = workerID * nRunsAll / nWorkers, hi = (workerID+1) * nRunsAll / nWorkers;
+    if (lo > 0) {
+      primerRun = dsAll.GetRunNumber(lo-1);
+      ds.AddRunNumber(primerRun);
+    }
+    for (size_t i = lo; i < hi; i++) ds.AddRunNumber(dsAll.GetRunNumber(i));
+    outputFile = Form("%s_part%i.root",outputBase.c_str(),workerID);
+    cout << Form("Worker %i: runs %i to %i, writing to %s\n", workerID, (int)dsAll.GetRunNumber(lo),
+      (int)dsAll.GetRunNumber(hi-1), outputFile.c_str());
+  }
+  else {
+    // A resumed skim reads the last finished run again, as a primer (see above)
+    if (nDone > 0) {
+      primerRun = dsAll.GetRunNumber(nDone-1);
+      ds.AddRunNumber(primerRun);
+    }
+    for (size_t i = nDone; i < nRunsAll; i++) ds.AddRunNumber(dsAll.GetRunNumber(i));
+  }
+
   // ==========================================================================
   // Set up germanium and veto data inputs.
 
@@ -169,7 +556,9 @@ int main(int argc, const char** argv)
   }
   else if (dsNum==4 && !simulatedInput)
     LoadDS4MuonList(muRuns,muRunTStarts,muTimes,muTypes,muUncert);
-  size_t iMu = 0, nMu = muTimes.size();
+  MuonIndex muIndex;
+  muIndex.Build(muRuns, muRunTStarts, muTimes, muTypes, muUncert);
+  size_t iMu = 0, nMu = muIndex.Size();
   if(nMu == 0 && !simulatedInput) {
     cout << "WARNING: couldn't load mu data" << endl;
     // return 0;
@@ -180,111 +569,119 @@ int main(int argc, const char** argv)
 
 
   // Set up the rest of the inputs from gatified data.
+  // Only the branches this skim uses are read (see SkimSchema).
+  SkimSchema schema(smallOutput, lowEnergy);
+  schema.EnableInputs(gatChain);
 
   // ID variables
-  TTreeReaderValue<double> runIn(gatReader, "run");
-  TTreeReaderValue<unsigned int> gatrevIn(gatReader, "gatrev");
-  TTreeReaderValue< vector<double> > channelIn(gatReader, "channel");
-  TTreeReaderValue< vector<int> > detIDIn(gatReader, "detID");
-  TTreeReaderValue< vector<int> > posIn(gatReader, "P");
-  TTreeReaderValue< vector<int> > detIn(gatReader, "D");
-  TTreeReaderValue< vector<int> > cryoIn(gatReader, "C");
-  TTreeReaderValue< vector<int> > mageIDIn(gatReader, "mageID");
-  TTreeReaderValue< vector<string> > detNameIn(gatReader, "detName");
-  TTreeReaderValue< vector<bool> > isEnrIn(gatReader, "isEnr");
-  TTreeReaderValue< vector<bool> > isNatIn(gatReader, "isNat");
+  SkimReader<double> runIn(gatReader, schema, "run");
+  SkimReader<unsigned int> gatrevIn(gatReader, schema, "gatrev");
+  SkimReader<vector<double>> channelIn(gatReader, schema, "channel");
+  SkimReader<vector<int>> detIDIn(gatReader, schema, "detID");
+  SkimReader<vector<int>> posIn(gatReader, schema, "P");
+  SkimReader<vector<int>> detIn(gatReader, schema, "D");
+  SkimReader<vector<int>> cryoIn(gatReader, schema, "C");
+  SkimReader<vector<int>> mageIDIn(gatReader, schema, "mageID");
+  SkimReader<vector<string>> detNameIn(gatReader, schema, "detName");
 
   // time variables
-  TTreeReaderValue<double> clockTimeIn(gatReader, "clockTime");
-  TTreeReaderValue<double> startTimeIn(gatReader, "startTime");
-  TTreeReaderValue<double> stopTimeIn(gatReader, "stopTime");
-  TTreeReaderValue<double> startClockTimeIn(gatReader, "startClockTime");
-  TTreeReaderValue<double> localTimeIn(gatReader, "localTime");
-  TTreeReaderValue<TTimeStamp> globalTimeIn(gatReader, "globalTime");
-  TTreeReaderValue<vector<double> > tOffsetIn(gatReader, "tOffset");
-  TTreeReaderValue<vector<double> > triggerTrapt0In(gatReader, "triggerTrapt0");
-  TTreeReaderValue< vector<double> > blrwfFMR50In(gatReader, "blrwfFMR50");
-  TTreeReaderValue< vector<int> > trapENMSampleIn(gatReader, "trapENMSample");
+  SkimReader<double> clockTimeIn(gatReader, schema, "clockTime");
+  SkimReader<double> startTimeIn(gatReader, schema, "startTime");
+  SkimReader<double> stopTimeIn(gatReader, schema, "stopTime");
+  SkimReader<double> startClockTimeIn(gatReader, schema, "startClockTime");
+  SkimReader<double> localTimeIn(gatReader, schema, "localTime");
+  SkimReader<TTimeStamp> globalTimeIn(gatReader, schema, "globalTime");
+  SkimReader<vector<double>> tOffsetIn(gatReader, schema, "tOffset");
+  SkimReader<vector<double>> triggerTrapt0In(gatReader, schema, "triggerTrapt0");
+  SkimReader<vector<double>> blrwfFMR50In(gatReader, schema, "blrwfFMR50");
+  SkimReader<vector<int>> trapENMSampleIn(gatReader, schema, "trapENMSample");
 
   // energy variables
-  TTreeReaderValue< vector<double> > trapENFIn(gatReader, "trapENF");
-  TTreeReaderValue< vector<double> > trapENMIn(gatReader, "trapENM");
-  TTreeReaderValue< vector<double> > trapENFCalIn(gatReader, "trapENFCal");
-  TTreeReaderValue< vector<double> > trapENMCalIn(gatReader, "trapENMCal");
-  TTreeReaderValue< vector<double> > trapECalIn(gatReader, "trapECal");
-  TTreeReaderValue< vector<double> > energyIn(gatReader, "energy");
+  SkimReader<vector<double>> trapENFIn(gatReader, schema, "trapENF");
+  SkimReader<vector<double>> trapENMIn(gatReader, schema, "trapENM");
+  SkimReader<vector<double>> trapENFCalIn(gatReader, schema, "trapENFCal");
+  SkimReader<vector<double>> trapENMCalIn(gatReader, schema, "trapENMCal");
+  SkimReader<vector<double>> trapECalIn(gatReader, schema, "trapECal");
+  SkimReader<vector<double>> energyIn(gatReader, schema, "energy");
 
   // pulse shape variables
-  TTreeReaderValue< vector<double> > tsCurrent50nsMaxIn(gatReader, "TSCurrent50nsMax");
-  TTreeReaderValue< vector<double> > tsCurrent100nsMaxIn(gatReader, "TSCurrent100nsMax");
-  TTreeReaderValue< vector<double> > tsCurrent200nsMaxIn(gatReader, "TSCurrent200nsMax");
-  TTreeReaderValue< vector<double> > triTrapMaxIn(gatReader, "triTrapMax");
-  TTreeReaderValue< vector<double> > dcrSlopeIn(gatReader, "nlcblrwfSlope");
-  TTreeReaderValue< vector<double> > RawWFblSlopeIn(gatReader, "RawWFblSlope");
-  TTreeReaderValue< vector<double> > RawWFblChi2In(gatReader, "RawWFblChi2");
+  SkimReader<vector<double>> tsCurrent50nsMaxIn(gatReader, schema, "TSCurrent50nsMax");
+  SkimReader<vector<double>> tsCurrent100nsMaxIn(gatReader, schema, "TSCurrent100nsMax");
+  SkimReader<vector<double>> tsCurrent200nsMaxIn(gatReader, schema, "TSCurrent200nsMax");
+  SkimReader<vector<double>> triTrapMaxIn(gatReader, schema, "triTrapMax");
+  SkimReader<vector<double>> dcrSlopeIn(gatReader, schema, "nlcblrwfSlope");
+  SkimReader<vector<double>> RawWFblSlopeIn(gatReader, schema, "RawWFblSlope");
+  SkimReader<vector<double>> RawWFblChi2In(gatReader, schema, "RawWFblChi2");
 
   // data cleaning variables
-  TTreeReaderValue<unsigned int> eventDC1BitsIn(gatReader, "EventDC1Bits");
+  SkimReader<unsigned int> eventDC1BitsIn(gatReader, schema, "EventDC1Bits");
   // const int kDoublePulserMask = (0x1 << 1) + 0x1; // pinghan pulsers + pulser tag channels
   // Pulser tag channel seems to miss a lot of pulsers! So let's just use Pinghan's (only).
   const int kPinghanPulserMask = 0x1 << 1; // pinghan pulsers
-  TTreeReaderValue< vector<unsigned int> > wfDCBitsIn(gatReader, "wfDCBits");
-  TTreeReaderValue< vector<double> > trapETailMinIn(gatReader, "trapETailMin");
-  TTreeReaderValue< vector<double> > nRisingXIn(gatReader, "fastTrapNLCWFsnRisingX");
-  TTreeReaderValue< vector<int> > nFlippedBitsIn(gatReader, "nFlippedBits");
-  TTreeReaderValue< vector<double> > threshKeVIn(gatReader, "threshKeV");
-  TTreeReaderValue< vector<double> > threshSigmaIn(gatReader, "threshSigma");
-  TTreeReaderValue< vector<double> > d2wf5MHzTo30MHzPowerIn(gatReader, "d2wf5MHzTo30MHzPower");
-  TTreeReaderValue< vector<double> > d2wf30MHzTo35MHzPowerIn(gatReader, "d2wf30MHzTo35MHzPower");
-  TTreeReaderValue< vector<double> > d2wf0MHzTo50MHzPowerIn(gatReader, "d2wf0MHzTo50MHzPower");
-  TTreeReaderValue< vector<double> > d2wfnoiseTagNormIn(gatReader, "d2wfnoiseTagNorm");
+  SkimReader<vector<unsigned int>> wfDCBitsIn(gatReader, schema, "wfDCBits");
+  SkimReader<vector<double>> trapETailMinIn(gatReader, schema, "trapETailMin");
+  SkimReader<vector<double>> nRisingXIn(gatReader, schema, "fastTrapNLCWFsnRisingX");
+  SkimReader<vector<int>> nFlippedBitsIn(gatReader, schema, "nFlippedBits");
+  SkimReader<vector<double>> threshKeVIn(gatReader, schema, "threshKeV");
+  SkimReader<vector<double>> threshSigmaIn(gatReader, schema, "threshSigma");
+  SkimReader<vector<double>> d2wf5MHzTo30MHzPowerIn(gatReader, schema, "d2wf5MHzTo30MHzPower");
+  SkimReader<vector<double>> d2wf30MHzTo35MHzPowerIn(gatReader, schema, "d2wf30MHzTo35MHzPower");
+  SkimReader<vector<double>> d2wf0MHzTo50MHzPowerIn(gatReader, schema, "d2wf0MHzTo50MHzPower");
+  SkimReader<vector<double>> d2wfnoiseTagNormIn(gatReader, schema, "d2wfnoiseTagNorm");
 
   //Temporary addition until all files reprocessed with fixed negative
   //saturated waveform tagging code.
-  TTreeReaderValue< vector<double> > rawWFMinIn(gatReader, "rawWFMin");
+  SkimReader<vector<double>> rawWFMinIn(gatReader, schema, "rawWFMin");
 
 
   // ==========================================================================
   // Set up output file
-  string outputFile = Form("skimDS%i",dsNum);
-  if (singleFile) outputFile += Form("_run%i",subRun);
-  else outputFile += Form("_%i",subRun);
-  if (smallOutput) outputFile += "_small";
-  if (lowEnergy) outputFile += "_low";
-  outputFile += ".root";
-  cout << outputFile << endl;
-  if (outputPath != "") outputFile = outputPath + "/" + outputFile;
-  TFile *fOut = TFile::Open(outputFile.c_str(), "recreate");
+  // In sharded mode, skimTree only holds the branch layout, and each run is filled into a clone of it.
+  TFile *fOut = NULL, *shardFile = NULL;
+  if (!shardOutput) fOut = TFile::Open(outputFile.c_str(), "recreate");
+  else gROOT->cd();
   TTree* skimTree = new TTree("skimTree", "skimTree");
 
+  // Optional pulser timeline (-p): one entry for each card hit by each Pinghan pulser.
+  // dtPulserCard for any event can be recomputed from this without rerunning the skim.
+  TTree* pulserTree = NULL;
+  int pRun=0, pCard=0;
+  double pTPulse=0;
+  if (pulserTimeline) {
+    pulserTree = new TTree("pulserTree", "pulser time for each card");
+    pulserTree->Branch("run", &pRun, "run/I");
+    pulserTree->Branch("card", &pCard, "card/I");
+    pulserTree->Branch("tPulse", &pTPulse, "tPulse/D");
+  }
+
   // output - run level variables & indices
   unsigned int skimgatrev = strtol(GATUtils::GetGATRevision(), NULL, 16);
   cout << "skimgatrev_" << skimgatrev << endl;
   int run=0, iEvent=0;
   unsigned int gatrev=0;
   vector<int> iHit;
-  skimTree->Branch("skimgatrev", &skimgatrev, "skimgatrev/i");
-  skimTree->Branch("gatrev", &gatrev, "gatrev/i");
-  skimTree->Branch("run", &run, "run/I");
-  skimTree->Branch("iEvent", &iEvent, "iEvent/I");
-  skimTree->Branch("iHit", &iHit);
+  schema.Branch(skimTree, "skimgatrev", &skimgatrev, "skimgatrev/i");
+  schema.Branch(skimTree, "gatrev", &gatrev, "gatrev/i");
+  schema.Branch(skimTree, "run", &run, "run/I");
+  schema.Branch(skimTree, "iEvent", &iEvent, "iEvent/I");
+  schema.Branch(skimTree, "iHit", &iHit);
 
   // output - ID variables
   vector<int> channel, pos, det, cryo, gain, mageID, detID, c0Chan;
   vector<string> detName;
   vector<bool> isEnr, isNat, isGood;
-  skimTree->Branch("channel", &channel);
-  skimTree->Branch("P", &pos);
-  skimTree->Branch("D", &det);
-  skimTree->Branch("C", &cryo);
-  skimTree->Branch("gain", &gain);
-  skimTree->Branch("mageID", &mageID);
-  skimTree->Branch("detID", &detID);
-  skimTree->Branch("detName", &detName);
-  skimTree->Branch("isEnr", &isEnr);
-  skimTree->Branch("isNat", &isNat);
-  skimTree->Branch("isGood", &isGood);
-  skimTree->Branch("c0Channels", &c0Chan);
+  schema.Branch(skimTree, "channel", &channel);
+  schema.Branch(skimTree, "P", &pos);
+  schema.Branch(skimTree, "D", &det);
+  schema.Branch(skimTree, "C", &cryo);
+  schema.Branch(skimTree, "gain", &gain);
+  schema.Branch(skimTree, "mageID", &mageID);
+  schema.Branch(skimTree, "detID", &detID);
+  schema.Branch(skimTree, "detName", &detName);
+  schema.Branch(skimTree, "isEnr", &isEnr);
+  schema.Branch(skimTree, "isNat", &isNat);
+  schema.Branch(skimTree, "isGood", &isGood);
+  schema.Branch(skimTree, "c0Channels", &c0Chan);
 
   // output - time variables
   double runTime_s=0, startTime=0, startTime0=0, stopTime=0, startClockTime,
@@ -294,73 +691,63 @@ int main(int argc, const char** argv)
   TTimeStamp globalTime;
   GetDSRunAndStartTimes(dsNum, runTime_s, startTime0);
   // cout << Form("%.0f  %.0f", runTime_s, startTime0);
-  skimTree->Branch("startTime_s", &startTime, "startTime/D");
-  skimTree->Branch("startTime0_s", &startTime0, "startTime0/D");
-  skimTree->Branch("runTime_s", &runTime_s, "runTime_s/D");
-  skimTree->Branch("stopTime_s", &stopTime, "stopTime/D");
-  skimTree->Branch("startClockTime_s", &startClockTime);
-  skimTree->Branch("clockTime_s", &clockTime);
-  skimTree->Branch("localTime_s", &localTime);
-  skimTree->Branch("globalTime", &globalTime);
-  skimTree->Branch("tOffset", &tOffset);
-  skimTree->Branch("triggerTrapt0",&triggerTrapt0);
-  skimTree->Branch("dtPulserGlobal",&dtPulserGlobal, "dtPulserGlobal/D");
-  skimTree->Branch("dtPulserCard",&dtPulserCard);
-  if (lowEnergy){
-    skimTree->Branch("trapENMSample", &trapENMSample);
-    skimTree->Branch("blrwfFMR50",&blrwfFMR50);
-  }
+  schema.Branch(skimTree, "startTime_s", &startTime, "startTime/D");
+  schema.Branch(skimTree, "startTime0_s", &startTime0, "startTime0/D");
+  schema.Branch(skimTree, "runTime_s", &runTime_s, "runTime_s/D");
+  schema.Branch(skimTree, "stopTime_s", &stopTime, "stopTime/D");
+  schema.Branch(skimTree, "startClockTime_s", &startClockTime);
+  schema.Branch(skimTree, "clockTime_s", &clockTime);
+  schema.Branch(skimTree, "localTime_s", &localTime);
+  schema.Branch(skimTree, "globalTime", &globalTime);
+  schema.Branch(skimTree, "tOffset", &tOffset);
+  schema.Branch(skimTree, "triggerTrapt0",&triggerTrapt0);
+  schema.Branch(skimTree, "dtPulserGlobal",&dtPulserGlobal, "dtPulserGlobal/D");
+  schema.Branch(skimTree, "dtPulserCard",&dtPulserCard);
+  schema.Branch(skimTree, "trapENMSample", &trapENMSample);
+  schema.Branch(skimTree, "blrwfFMR50",&blrwfFMR50);
 
   // output - energy variables
   vector<double> trapECal, onBoardE, trapENFCal, trapENMCal, trapENF, trapENM, trapENFCalC, trapENMCalC;
   double sumEH=0, sumEL=0, sumEHClean=0, sumELClean=0, sumEHL=0;
-  skimTree->Branch("trapENFCal", &trapENFCal);
-  skimTree->Branch("trapENMCal", &trapENMCal);
-  skimTree->Branch("trapENFCalC", &trapENFCalC);
-  skimTree->Branch("trapENMCalC", &trapENMCalC);
-  if(!smallOutput) {
-    skimTree->Branch("trapECal", &trapECal);
-    skimTree->Branch("onBoardE", &onBoardE);
-  }
-  if (lowEnergy){
-    skimTree->Branch("trapENF", &trapENF);
-    skimTree->Branch("trapENM", &trapENM);
-  }
-  skimTree->Branch("sumEHL", &sumEHL, "sumEHL/D");
-  skimTree->Branch("sumEH", &sumEH, "sumEH/D");
-  skimTree->Branch("sumEL", &sumEL, "sumEL/D");
-  skimTree->Branch("sumEHClean", &sumEHClean, "sumEHClean/D");
-  skimTree->Branch("sumELClean", &sumELClean, "sumELClean/D");
+  schema.Branch(skimTree, "trapENFCal", &trapENFCal);
+  schema.Branch(skimTree, "trapENMCal", &trapENMCal);
+  schema.Branch(skimTree, "trapENFCalC", &trapENFCalC);
+  schema.Branch(skimTree, "trapENMCalC", &trapENMCalC);
+  schema.Branch(skimTree, "trapECal", &trapECal);
+  schema.Branch(skimTree, "onBoardE", &onBoardE);
+  schema.Branch(skimTree, "trapENF", &trapENF);
+  schema.Branch(skimTree, "trapENM", &trapENM);
+  schema.Branch(skimTree, "sumEHL", &sumEHL, "sumEHL/D");
+  schema.Branch(skimTree, "sumEH", &sumEH, "sumEH/D");
+  schema.Branch(skimTree, "sumEL", &sumEL, "sumEL/D");
+  schema.Branch(skimTree, "sumEHClean", &sumEHClean, "sumEHClean/D");
+  schema.Branch(skimTree, "sumELClean", &sumELClean, "sumELClean/D");
 
   // output - granularity variables
   int mH=0, mL=0, mHClean=0, mLClean=0, mHL=0;
-  skimTree->Branch("mHL", &mHL, "mHL/I");
-  skimTree->Branch("mH", &mH, "mH/I");
-  skimTree->Branch("mL", &mL, "mL/I");
-  skimTree->Branch("mHClean", &mHClean, "mHClean/I");
-  skimTree->Branch("mLClean", &mLClean, "mLClean/I");
+  schema.Branch(skimTree, "mHL", &mHL, "mHL/I");
+  schema.Branch(skimTree, "mH", &mH, "mH/I");
+  schema.Branch(skimTree, "mL", &mL, "mL/I");
+  schema.Branch(skimTree, "mHClean", &mHClean, "mHClean/I");
+  schema.Branch(skimTree, "mLClean", &mLClean, "mLClean/I");
 
   // output - pulse shape variables
   vector<double> avse, kvorrT, trapETailMin;
   vector<double> dcr85, dcr90, dcr95, dcr98, dcr99, dcr995, dcr999, dcrctc90, nlcblrwfSlope, RawWFblSlope, RawWFblChi2;
-  skimTree->Branch("avse", &avse);
-  skimTree->Branch("nlcblrwfSlope", &nlcblrwfSlope);
-  skimTree->Branch("dcr99", &dcr99);
-  skimTree->Branch("dcr95", &dcr95);
-  skimTree->Branch("dcr90", &dcr90);
-  skimTree->Branch("dcrctc90", &dcrctc90);
-  if(!smallOutput) {
-    skimTree->Branch("trapETailMin", &trapETailMin);
-    skimTree->Branch("kvorrT", &kvorrT);
-    skimTree->Branch("dcr85", &dcr85);
-    skimTree->Branch("dcr98", &dcr98);
-    skimTree->Branch("dcr995", &dcr995);
-    skimTree->Branch("dcr999", &dcr999);
-  }
-  if (lowEnergy) {
-    skimTree->Branch("RawWFblSlope",&RawWFblSlope);
-    skimTree->Branch("RawWFblChi2",&RawWFblChi2);
-  }
+  schema.Branch(skimTree, "avse", &avse);
+  schema.Branch(skimTree, "nlcblrwfSlope", &nlcblrwfSlope);
+  schema.Branch(skimTree, "dcr99", &dcr99);
+  schema.Branch(skimTree, "dcr95", &dcr95);
+  schema.Branch(skimTree, "dcr90", &dcr90);
+  schema.Branch(skimTree, "dcrctc90", &dcrctc90);
+  schema.Branch(skimTree, "trapETailMin", &trapETailMin);
+  schema.Branch(skimTree, "kvorrT", &kvorrT);
+  schema.Branch(skimTree, "dcr85", &dcr85);
+  schema.Branch(skimTree, "dcr98", &dcr98);
+  schema.Branch(skimTree, "dcr995", &dcr995);
+  schema.Branch(skimTree, "dcr999", &dcr999);
+  schema.Branch(skimTree, "RawWFblSlope",&RawWFblSlope);
+  schema.Branch(skimTree, "RawWFblChi2",&RawWFblChi2);
 
   // output - LN tag variables
   // NOTE: As written, LN fills between modules do NOT overlap,
@@ -368,37 +755,38 @@ int main(int argc, const char** argv)
   vector<double> lnFillTimes1, lnFillTimes2;
   LoadLNFillTimes1(lnFillTimes1, dsNum);
   LoadLNFillTimes2(lnFillTimes2, dsNum);
+  LNFillVeto lnVeto1, lnVeto2; // 15 minutes before to 5 minutes after each fill
+  lnVeto1.Build(lnFillTimes1);
+  lnVeto2.Build(lnFillTimes2);
   bool isLNFill1, isLNFill2;
-  skimTree->Branch("isLNFill1", &isLNFill1);
-  skimTree->Branch("isLNFill2", &isLNFill2);
+  schema.Branch(skimTree, "isLNFill1", &isLNFill1);
+  schema.Branch(skimTree, "isLNFill2", &isLNFill2);
 
   // output - data cleaning variables
   unsigned int eventDC1Bits = 0;
   vector<unsigned int> wfDCBits;
   vector<int> nX, nFlippedBits;
   vector<double> d2wf5MHzTo30MHzPower, d2wf30MHzTo35MHzPower, d2wf0MHzTo50MHzPower, d2wfnoiseTagNorm, threshKeV, threshSigma;
-  skimTree->Branch("EventDC1Bits", &eventDC1Bits, "eventDC1Bits/i");
-  skimTree->Branch("wfDCBits", &wfDCBits);
-  skimTree->Branch("d2wfnoiseTagNorm", &d2wfnoiseTagNorm);
-  skimTree->Branch("nX", &nX);
-  skimTree->Branch("nFlippedBits", &nFlippedBits);
-  if (lowEnergy){
-    skimTree->Branch("d2wf5MHzTo30MHzPower",&d2wf5MHzTo30MHzPower);
-    skimTree->Branch("d2wf30MHzTo35MHzPower",&d2wf30MHzTo35MHzPower);
-    skimTree->Branch("d2wf0MHzTo50MHzPower",&d2wf0MHzTo50MHzPower);
-    skimTree->Branch("threshKeV",&threshKeV);
-    skimTree->Branch("threshSigma",&threshSigma);
-  }
+  schema.Branch(skimTree, "EventDC1Bits", &eventDC1Bits, "eventDC1Bits/i");
+  schema.Branch(skimTree, "wfDCBits", &wfDCBits);
+  schema.Branch(skimTree, "d2wfnoiseTagNorm", &d2wfnoiseTagNorm);
+  schema.Branch(skimTree, "nX", &nX);
+  schema.Branch(skimTree, "nFlippedBits", &nFlippedBits);
+  schema.Branch(skimTree, "d2wf5MHzTo30MHzPower",&d2wf5MHzTo30MHzPower);
+  schema.Branch(skimTree, "d2wf30MHzTo35MHzPower",&d2wf30MHzTo35MHzPower);
+  schema.Branch(skimTree, "d2wf0MHzTo50MHzPower",&d2wf0MHzTo50MHzPower);
+  schema.Branch(skimTree, "threshKeV",&threshKeV);
+  schema.Branch(skimTree, "threshSigma",&threshSigma);
 
   // output - muon veto variables
   vector<double> dtmu_s;
   int muType;
   double muTUnc;
   bool muVeto;
-  skimTree->Branch("dtmu_s", &dtmu_s);
-  skimTree->Branch("muType", &muType);
-  skimTree->Branch("muTUnc", &muTUnc);
-  skimTree->Branch("muVeto", &muVeto);
+  schema.Branch(skimTree, "dtmu_s", &dtmu_s);
+  schema.Branch(skimTree, "muType", &muType);
+  schema.Branch(skimTree, "muTUnc", &muTUnc);
+  schema.Branch(skimTree, "muVeto", &muVeto);
 
   // output - detector mass data and bad/veto-only detector lists
   double mAct_M1Total_kg=0, mAct_M1enr_kg=0, mAct_M1nat_kg=0;
@@ -416,15 +804,15 @@ int main(int argc, const char** argv)
   // cout << Form(" ds %i  m1veto %.4f  m2veto %.4f\n", dsNum, mVeto_M1Total_kg, mVeto_M2Total_kg);
 
   vector<double> mAct_g;
-  skimTree->Branch("mAct_g", &mAct_g);
-  skimTree->Branch("mAct_M1Total_kg", &mAct_M1Total_kg, "mAct_M1Total_kg/D");
-  skimTree->Branch("mAct_M1enr_kg", &mAct_M1enr_kg, "mAct_M1enr_kg/D");
-  skimTree->Branch("mAct_M1nat_kg", &mAct_M1nat_kg, "mAct_M1nat_kg/D");
-  skimTree->Branch("mAct_M2Total_kg", &mAct_M2Total_kg, "mAct_M2Total_kg/D");
-  skimTree->Branch("mAct_M2enr_kg", &mAct_M2enr_kg, "mAct_M2enr_kg/D");
-  skimTree->Branch("mAct_M2nat_kg", &mAct_M2nat_kg, "mAct_M2nat_kg/D");
-  skimTree->Branch("mVeto_M1Total_kg", &mVeto_M1Total_kg, "mVeto_M1Total_kg/D");
-  skimTree->Branch("mVeto_M2Total_kg", &mVeto_M2Total_kg, "mVeto_M2Total_kg/D");
+  schema.Branch(skimTree, "mAct_g", &mAct_g);
+  schema.Branch(skimTree, "mAct_M1Total_kg", &mAct_M1Total_kg, "mAct_M1Total_kg/D");
+  schema.Branch(skimTree, "mAct_M1enr_kg", &mAct_M1enr_kg, "mAct_M1enr_kg/D");
+  schema.Branch(skimTree, "mAct_M1nat_kg", &mAct_M1nat_kg, "mAct_M1nat_kg/D");
+  schema.Branch(skimTree, "mAct_M2Total_kg", &mAct_M2Total_kg, "mAct_M2Total_kg/D");
+  schema.Branch(skimTree, "mAct_M2enr_kg", &mAct_M2enr_kg, "mAct_M2enr_kg/D");
+  schema.Branch(skimTree, "mAct_M2nat_kg", &mAct_M2nat_kg, "mAct_M2nat_kg/D");
+  schema.Branch(skimTree, "mVeto_M1Total_kg", &mVeto_M1Total_kg, "mVeto_M1Total_kg/D");
+  schema.Branch(skimTree, "mVeto_M2Total_kg", &mVeto_M2Total_kg, "mVeto_M2Total_kg/D");
 
   // Update the veto list and active mass by channel and run (DS-5 only)
   map <int,map<int,bool>> fix_detIDisVetoOnly;
@@ -481,44 +869,70 @@ int main(int argc, const char** argv)
   }
 
   // ==========================================================================
-  // Detect if we are in continuous running mode from the built file.
-  // Update the file path every time the run number changes.
-  // The built tree is NOT loaded; this should NOT appreciably slow the skimmer down.
+  // Detect if we are in continuous running mode, and get the pulser tag channel list.
+  // These come from the built file header, through the run metadata cache,
+  // so the built file is only opened the first time a run is skimmed.
   // Rule of thumb: CR mode not enabled for DS-0 and DS-1 prior to 11635.
-  bool isCRMode = false;
+  RunMetaCache runMeta(GetRunMetaCachePath(dsNum));
   gatReader.SetEntry(0);
-  string builtPath = ds.GetPathToRun(*runIn,GATDataSet::kBuilt);
-  TDirectory* tdir = gROOT->CurrentDirectory();
-  TFile *bltFile = new TFile(builtPath.c_str(),"READ");
-  MJTRun *runInfo = (MJTRun*)bltFile->Get("run");
-  isCRMode = (runInfo->GetStartRunBoundaryType()==1 || runInfo->GetStopRunBoundaryType()==1);
+  const RunMetadata *meta = runMeta.Get((int)*runIn);
+  if (meta == NULL) return 1;
+  bool isCRMode = meta->IsCRMode();
   if (!isCRMode) cout << Form("Continuous running mode NOT enabled for DS-%i, run %.0f\n",dsNum,*runIn);
-
-  MJTChannelMap *chMap = (MJTChannelMap*)bltFile->Get("ChannelMap");
-  vector<uint32_t> pulserMons = chMap->GetPulserChanList();
+  ChannelSlots chSlots; // pulser monitor and cryostat 0 flags, and the LG-skip hit table
+  chSlots.SetRun(*meta);
 
   // Variables for time of pulser event (dtPulser)
-  // This assumes the Gretina card/settings map doesn't change for this skim period.
+  // Cards have key: 100*VME + cardSlot to differentiate between M1 and M2.
+  // The channel -> card map is updated every run, the pulser times carry over.
   double dummyDTGlobal = -1.;
-  map<int, double> dummydTCard = {};
-  katrin::KTable chTable = chMap->GetTable();
-  map<int, int> pulserCardMap = {};
-  vector<katrin::KVariant> chVMEVec = chTable.GetColumn("kVME");
-  vector<katrin::KVariant> chSlotVec = chTable.GetColumn("kCardSlot");
-  vector<katrin::KVariant> chIDHiVec = chTable.GetColumn("kIDHi");
-  vector<katrin::KVariant> chIDLoVec = chTable.GetColumn("kIDLo");
-  for(size_t i = 0; i < chSlotVec.size(); i++)
-  {
-    // dummydTCard has key: 100*VME + cardSlot to differentiate between M1 and M2
-    dummydTCard.insert(make_pair((int)chVMEVec[i].AsDouble()*100 + (int)chSlotVec[i].AsDouble(), -1.));
-    pulserCardMap[(int)chIDHiVec[i].AsDouble()] = (int)chVMEVec[i].AsDouble()*100 + (int)chSlotVec[i].AsDouble();
-    pulserCardMap[(int)chIDLoVec[i].AsDouble()] = (int)chVMEVec[i].AsDouble()*100 + (int)chSlotVec[i].AsDouble();
-  }
+  PulserCardTimes pulserCards;
+  pulserCards.SetRun(*meta);
 
   gatReader.SetTree(gatChain); // reset the reader
-  gROOT->cd(tdir->GetPath());
+
+  // Calibration parameters (ENFC, AvsE, DCR) for the current run
+  RunCalibration runCal;
+
+  // Resumed skim: copy the finished runs from the old output.
+  // This also restores the cryostat-0 channel list.
+  if (nKeep > 0) {
+    TFile *fOld = TFile::Open(oldOutputFile.c_str(), "READ");
+    TTree *oldTree = (TTree*)fOld->Get("skimTree");
+    skimTree->CopyAddresses(oldTree);
+    for (Long64_t i = 0; i < nKeep; i++) {
+      oldTree->GetEntry(i);
+      skimTree->Fill();
+    }
+    skimTree->CopyAddresses(oldTree, true); // undo
+    fOld->Close();
+    fOut->cd();
+    for (auto ch : c0Chan) chSlots.FlagCryo0(ch);
+    cout << "Copied " << nKeep << " entries from " << oldOutputFile << endl;
+  }
+
+  // Hit energy cut.  Same for HG and LG in small skim files.
+  auto passEnergy = [&](int chan, double eNFCal, double eMax) {
+    double thresh = smallOutput ? 200. : (chan%2 == 0 ? energyThresh : 10.);
+    return !(eNFCal < thresh || eMax < thresh);
+  };
+
+  // Output trees for the current run (the clones, in sharded mode)
+  TTree *outTree = skimTree, *outPulser = pulserTree;
+  Long64_t nSaved = 0;
+  auto closeShard = [&]() {
+    if (shardFile == NULL) return;
+    shardFile->cd();
+    nSaved += outTree->GetEntries();
+    outTree->Write("", TObject::kOverwrite);
+    if (outPulser != NULL) outPulser->Write("", TObject::kOverwrite);
+    shardFile->Close(); // deletes the clones
+    shardFile = NULL;
+    outTree = skimTree, outPulser = pulserTree;
+  };
 
   // Loop over events
+  vector<int> hits; // this is a VECTOR INDEX, not a channel number
   double runSave = -1;
   int run_count = 0;
   bool lnFillCoverage = true;
@@ -526,21 +940,31 @@ int main(int argc, const char** argv)
   {
     // stuff to do on run boundaries
     if(runSave != *runIn) {
+      int prevRun = (int)runSave;
       runSave = *runIn;
+      if (shardOutput) {
+        closeShard();
+        if ((int)runSave != primerRun) {
+          shardFile = TFile::Open(SkimShards::ShardFile(shardDir, (int)runSave).c_str(), "recreate");
+          outTree = skimTree->CloneTree(0);
+          if (pulserTree != NULL) outPulser = pulserTree->CloneTree(0);
+        }
+      }
       cout << "Processing run " << *runIn << ", "
-           << skimTree->GetEntries() << " entries saved so far"
+           << (shardOutput ? nSaved : skimTree->GetEntries()) << " entries saved so far"
            << endl;
-      skimTree->Write("", TObject::kOverwrite);
+      if (!shardOutput) skimTree->Write("", TObject::kOverwrite);
+      if (resume && prevRun > 0 && prevRun != primerRun) {
+        fOut->SaveSelf(kTRUE);
+        writeCheckpoints(ckptPath, {makeCheckpoint(prevRun, skimTree->GetEntries())}, true);
+      }
 
       // Detect CR mode for new run and grab the channel map's pulser tag channel list
-      builtPath = ds.GetPathToRun(runSave,GATDataSet::kBuilt);
-      bltFile->Close();
-      bltFile = new TFile(builtPath.c_str(),"READ");
-      runInfo = (MJTRun*)bltFile->Get("run");
-      isCRMode = (runInfo->GetStartRunBoundaryType() == MJTRun::kContinuousNoTSReset || runInfo->GetStopRunBoundaryType() == MJTRun::kContinuousNoTSReset);
-      chMap = (MJTChannelMap*)bltFile->Get("ChannelMap");
-      pulserMons = chMap->GetPulserChanList();
-      gROOT->cd(tdir->GetPath());
+      meta = runMeta.Get((int)runSave);
+      if (meta == NULL) return 1;
+      isCRMode = meta->IsCRMode();
+      chSlots.SetRun(*meta);
+      pulserCards.SetRun(*meta);
 
       // Update active mass for this run.
       if (dsNum==1 || dsNum==5) {
@@ -557,6 +981,9 @@ int main(int argc, const char** argv)
         detIDIsBad=fix_detIDisBad[*runIn];
       }
 
+      // Resolve this run's calibration parameters
+      runCal.Load(dsNum, (int)*runIn);
+
       // Check if we are covered by the LN fill tag.
       bool runCov = GetLNRunCoverage(dsNum,*runIn);
       if (!runCov && lnFillCoverage) {
@@ -571,13 +998,29 @@ int main(int argc, const char** argv)
     {
       dummyDTGlobal = (double)*globalTimeIn;
       // cout << (int)dummyDTGlobal << endl;
-  		for (size_t i = 0; i < (*channelIn).size(); i++) {
-  			if(pulserCardMap[(*channelIn)[i]] == 0) continue; // Skip PMon channels
-  			dummydTCard[ pulserCardMap[(*channelIn)[i]] ] = (double)*globalTimeIn + (*tOffsetIn)[i]/CLHEP::s;
-  		}
+      for (size_t i = 0; i < (*channelIn).size(); i++) {
+        int pCh = (*channelIn)[i];
+        double pTime = (double)*globalTimeIn + (*tOffsetIn)[i]/CLHEP::s;
+        if (!pulserCards.Update(pCh, pTime)) continue; // Skip PMon channels
+        if (pulserTree != NULL && (int)*runIn != primerRun) {
+          pRun = (int)*runIn, pCard = pulserCards.Card(pCh), pTPulse = pTime;
+          outPulser->Fill();
+        }
+      }
       continue;
     }
 
+    // Pre-filter: most events have no hit above threshold.  Check that at least one hit
+    // passes the energy and bad detector cuts before touching any other branch.
+    // The hit loop below only ever keeps a subset of these hits.
+    bool anyHit = false;
+    for (size_t i = 0; i < (*channelIn).size() && !anyHit; i++) {
+      if (!passEnergy((int)(*channelIn)[i], (*trapENFCalIn)[i], (*trapECalIn)[i])) continue;
+      if (!simulatedInput && detIDIsBad[(*detIDIn)[i]]) continue;
+      anyHit = true;
+    }
+    if (!anyHit) continue;
+
     // Clear all hit-level vector variables
     iHit.resize(0);
     trapENFCal.resize(0);
@@ -655,42 +1098,19 @@ int main(int argc, const char** argv)
       {
         // Calculate muon veto tag based on the FIRST HIT in the event.
         // 1. Find the most recent muon to this event
-        while(1) {
-            if(iMu >= nMu-1) break;
-            double tmuUnc = 1.e-8; // normally 10ns uncertainty
-            if (muUncert[iMu+1] > tmuUnc) tmuUnc = muUncert[iMu+1];
-            if (muRuns[iMu+1] > run) break;
-            else if (muRuns[iMu+1]==run && (muTimes[iMu+1]-tmuUnc) > clockTime) break;
-            // printf("Inc:iMu+1 %-4lu  gRun %-4i  mRun %-4i  tGe %-8.3f  tMu %-8.3f  dtRun %-8.0f  dtEvent %-8.0f\n" ,iMu+1, run, muRuns[iMu+1], clockTime, muTimes[iMu], muRunTStarts[iMu+1]-startTime, (muTimes[iMu+1] - tmuUnc) - clockTime);
-            iMu++;
-          }
+        iMu = muIndex.FindLast(run, clockTime);
         // 2. Calculate time since last muon, apply coincidence window, assign to output.
         // NOTE: If there has been a clock reset since the last muon hit, this delta-t will be incorrect.
-        // NOTE: DS-4 uses a larger window due to sync issues.
-        double dtmu = 0;
-        if (!isCRMode) dtmu = (startTime - muRunTStarts[iMu]) + (clockTime - muTimes[iMu]);
-        else           dtmu = clockTime - muTimes[iMu];
-        if (dsNum == 4) muVeto = (dtmu > -3.*(muUncert[iMu]) && dtmu < (4. + muUncert[iMu]));
-        else            muVeto = (dtmu > -1.*(muUncert[iMu]) && dtmu < (1. + muUncert[iMu]));
-        muType = muTypes[iMu];
-        muTUnc = muUncert[iMu];
-        // if (muVeto) printf("Coin: iMu %-4lu  det %i  gRun %-4i  mRun %-5i  tGe %-7.3f  tMu %-7.3f  veto? %i  dtmu %.2f +/- %.2f\n", iMu,hitCh,run,muRuns[iMu],clockTime,muTimes[iMu],muVeto,dtmu,muUncert[iMu]);
+        double dtmu = muIndex.DeltaT(iMu, clockTime, startTime, isCRMode);
+        muVeto = muIndex.InWindow(iMu, dtmu, dsNum);
+        muType = muIndex.types[iMu];
+        muTUnc = muIndex.uncert[iMu];
+        // if (muVeto) printf("Coin: iMu %-4lu  det %i  gRun %-4i  mRun %-5i  tGe %-7.3f  tMu %-7.3f  veto? %i  dtmu %.2f +/- %.2f\n", iMu,hitCh,run,muIndex.runs[iMu],clockTime,muIndex.times[iMu],muVeto,dtmu,muIndex.uncert[iMu]);
       }
 
       // Calculate LN fill tag.
-      isLNFill1 = 0, isLNFill2 = 0;
-      for(size_t i = 0; i < lnFillTimes1.size(); i++) {
-        if(lnFillTimes1[i] + 300 < (double)globalTime) continue;  // 5 minutes after
-        if(lnFillTimes1[i] - 900 > (double)globalTime) break;     // 15 minutes before
-        isLNFill1 = true;
-        break;
-      }
-      for(size_t i = 0; i < lnFillTimes2.size(); i++) {
-        if(lnFillTimes2[i] + 300 < (double)globalTime) continue;
-        if(lnFillTimes2[i] - 900 > (double)globalTime) break;
-        isLNFill2 = true;
-        break;
-      }
+      isLNFill1 = lnVeto1.IsVetoed((double)globalTime);
+      isLNFill2 = lnVeto2.IsVetoed((double)globalTime);
     }
 
     // ==========================================================================
@@ -700,15 +1120,15 @@ int main(int argc, const char** argv)
     //       decreases the "true" dead time by swapping in LG events
     //       when the corresponding HG events are "bad" or do not exist.
 
-    vector<int> hits; // this is a VECTOR INDEX, not a channel number
+    hits.clear();
     if (!noSkip)
     {
-      // Get a map of channel numbers to vector indexes for this event.
+      // Fill the channel table with vector indexes for this event.
       // Skip any stray hits from pulser monitor channels.
-      map<int,int> chIdxMap;
       for (size_t i = 0; i < (*channelIn).size(); i++) {
-        if (find(pulserMons.begin(),pulserMons.end(),(*channelIn)[i])!=pulserMons.end()) continue;
-        chIdxMap[(*channelIn)[i]] = (int)i;
+        int chan = (*channelIn)[i];
+        if (chSlots.IsPulserMon(chan)) continue;
+        chSlots.SetHit(chan, (int)i);
       }
 
       // Loop over the raw list of channels
@@ -717,16 +1137,15 @@ int main(int argc, const char** argv)
         int chan = (*channelIn)[i];
 
         // Take LG if HG is not available
-        if (chan%2==1 && chIdxMap.find(chan-1)==chIdxMap.end()) {
+        if (chan%2==1 && chSlots.HitIndex(chan-1) < 0) {
           hits.push_back(i);
           continue;
         }
 
         // Check if LG hit exists
-        vector<int>::iterator it;
         if (chan%2==0) {
-          if (chIdxMap.find(chan+1)!=chIdxMap.end()) {
-            int iLG = chIdxMap[chan+1];
+          int iLG = chSlots.HitIndex(chan+1);
+          if (iLG >= 0) {
 
             // Take LG if HG is saturated and/or late trigger
             bool isSat = (*wfDCBitsIn)[i] & 0x40;  // RSDC Bit 6 - either pos. or neg. saturated WF
@@ -739,6 +1158,10 @@ int main(int argc, const char** argv)
             hits.push_back(i); // No LG hit, we have to use HG.
         }
       }
+
+      // Reset the table for the next event
+      for (size_t i = 0; i < (*channelIn).size(); i++)
+        chSlots.ClearHit((*channelIn)[i]);
     }
     else {
       for (size_t i = 0; i < (*channelIn).size(); i++)
@@ -755,10 +1178,7 @@ int main(int argc, const char** argv)
       double hitENF = (*trapENFIn)[i];
       double hitEMax = (*trapECalIn)[i];
       int hitCh = (*channelIn)[i];
-      if (!smallOutput && hitCh%2 == 0 && (hitENFCal < energyThresh || hitEMax < energyThresh)) continue;
-      if (!smallOutput && hitCh%2 == 1 && (hitENFCal < 10. || hitEMax < 10.)) continue;
-      if (smallOutput && hitCh%2 == 0 && (hitENFCal <  200. || hitEMax < 200.)) continue;
-      if (smallOutput && hitCh%2 == 1 && (hitENFCal < 200. || hitEMax < 200.)) continue;
+      if (!passEnergy(hitCh, hitENFCal, hitEMax)) continue;
 
       // Skip hits from totally "bad" detectors (not biased, etc)
       // for veto-only detectors, skip if trapENFCal or abs(trapENF) is < 10 keV
@@ -769,8 +1189,7 @@ int main(int argc, const char** argv)
       // Skip any hits from a nonsense cryostat
       int hitCryo = (*cryoIn)[i];
       if (hitCryo == 0) {
-        if (find(c0Chan.begin(), c0Chan.end(), hitCh) == c0Chan.end())
-          c0Chan.push_back(hitCh);
+        if (chSlots.FlagCryo0(hitCh)) c0Chan.push_back(hitCh);
         continue;
       }
 
@@ -791,8 +1210,13 @@ int main(int argc, const char** argv)
       isNat.push_back((*detNameIn)[i][0] == 'B');
       mAct_g.push_back(actM4Det_g[hitDetID]);
       isGood.push_back(!detIDIsVetoOnly[hitDetID]);
-      trapENFCalC.push_back(GetENFC(hitCh, dsNum, hitENFCal, run));
-      trapENMCalC.push_back(GetENMC(hitCh, dsNum, hitENMCal, run));
+
+      // Corrected energies, AvsE, and DCR, all in one pass
+      HitCalibration hitCal;
+      runCal.Compute(hitCh, hitENF, hitENFCal, hitENMCal, (*tsCurrent50nsMaxIn)[i], (*tsCurrent100nsMaxIn)[i],
+        (*tsCurrent200nsMaxIn)[i], (*dcrSlopeIn)[i], hitCal);
+      trapENFCalC.push_back(hitCal.trapENFCalC);
+      trapENMCalC.push_back(hitCal.trapENMCalC);
 
       //============================================================================
       // FIXME: Temporary change to fix some data cleaning bits at the skim
@@ -840,23 +1264,20 @@ int main(int argc, const char** argv)
         kvorrT.push_back((*triTrapMaxIn)[i]);
         trapETailMin.push_back((*trapETailMinIn)[i]);
       }
-      double a50 = (*tsCurrent50nsMaxIn)[i];
-      double a100 = (*tsCurrent100nsMaxIn)[i];
-      double a200 = (*tsCurrent200nsMaxIn)[i];
-      avse.push_back(GetAvsE(hitCh, a50, a100, a200, hitENF, hitENFCal, dsNum, run));
+      avse.push_back(hitCal.avse);
       nlcblrwfSlope.push_back((*dcrSlopeIn)[i]);
-      dcr99.push_back(GetDCR99(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-      dcr90.push_back(GetDCR90(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-      dcr95.push_back(GetDCR95(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-      dcrctc90.push_back(GetDCRCTC90(hitCh, (*dcrSlopeIn)[i], hitENFCal, hitENMCal, dsNum));
+      dcr99.push_back(hitCal.dcr99);
+      dcr90.push_back(hitCal.dcr90);
+      dcr95.push_back(hitCal.dcr95);
+      dcrctc90.push_back(hitCal.dcrctc90);
       triggerTrapt0.push_back((*triggerTrapt0In)[i]);
       dtPulserGlobal = (double)globalTime - dummyDTGlobal;
-      dtPulserCard.push_back((double)globalTime + tOffset[i]/CLHEP::s - dummydTCard[pulserCardMap[hitCh]]);
+      dtPulserCard.push_back((double)globalTime + tOffset[i]/CLHEP::s - pulserCards.LastPulse(hitCh));
       if(!smallOutput){
-        dcr85.push_back(GetDCR85(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-        dcr98.push_back(GetDCR98(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-        dcr995.push_back(GetDCR995(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
-        dcr999.push_back(GetDCR999(hitCh, (*dcrSlopeIn)[i], hitENMCal, dsNum, run));
+        dcr85.push_back(hitCal.dcr85);
+        dcr98.push_back(hitCal.dcr98);
+        dcr995.push_back(hitCal.dcr995);
+        dcr999.push_back(hitCal.dcr999);
       }
       if (lowEnergy) {
         trapENF.push_back((*trapENFIn)[i]);
@@ -873,11 +1294,8 @@ int main(int argc, const char** argv)
       }
 
       if (nMu!=0) {
-        double dtmu = 0; // same calculation as above, only for each hit
-        double hitTS = clockTime + tOffset[i]/CLHEP::s;
-        if (!isCRMode) dtmu = (startTime - muRunTStarts[iMu]) + (hitTS - muTimes[iMu]);
-        else           dtmu = hitTS - muTimes[iMu];
-        dtmu_s.push_back(dtmu);
+        double hitTS = clockTime + tOffset[i]/CLHEP::s; // same calculation as above, only for each hit
+        dtmu_s.push_back(muIndex.DeltaT(iMu, hitTS, startTime, isCRMode));
       }
 
       // Granularity (multiplicity) and sum energy calculation
@@ -906,18 +1324,161 @@ int main(int argc, const char** argv)
     } // end loop over hits.
 
     // Done with this event.
-    // Don't write it to output if it has no good hits.
+    // Don't write it to output if it has no good hits, or if it's from a worker's primer run.
     if(trapENFCal.size() == 0) continue;
-    skimTree->Fill();
+    if(run == primerRun) continue;
+    outTree->Fill();
   }
 
   // ==========================================================================
   // Done with loop over entries.
   // Write output tree to output file
+  if (shardOutput) {
+    closeShard();
+    cout << nSaved << " entries saved.\n";
+    // -j workers leave the index and the run metadata cache to the parent
+    if (workerID == -1) {
+      SkimShards::WriteIndex(shardDir);
+      runMeta.Save();
+    }
+    else writeC0List(Form("%s_part%i.c0",outputBase.c_str(),workerID), c0Chan);
+    return 0;
+  }
   cout << "Closing out skim file ..." << endl;
   skimTree->Write("", TObject::kOverwrite);
-  cout << skimTree->GetEntries() << " entries saved.\n";
+  Long64_t nSkimmed = skimTree->GetEntries(); // the tree is deleted when fOut closes
+  cout << nSkimmed << " entries saved.\n";
+  if (pulserTree != NULL) {
+    pulserTree->Write("", TObject::kOverwrite);
+    cout << pulserTree->GetEntries() << " pulser times saved.\n";
+  }
 
   fOut->Close();
+  if (resume) {
+    if (runSave > 0 && (int)runSave != primerRun)
+      writeCheckpoints(ckptPath, {makeCheckpoint((int)runSave, nSkimmed)}, true);
+    remove(oldOutputFile.c_str());
+  }
+  if (workerID == -1) runMeta.Save();
+  else writeC0List(Form("%s_part%i.c0",outputBase.c_str(),workerID), c0Chan);
   return 0;
 }
+
+// ==========================================================================
+// Checkpoint file: one line per finished run, "run entries fileSize fileMTime"
+
+vector<SkimCheckpoint> readCheckpoints(string path)
+{
+  vector<SkimCheckpoint> ckpts;
+  ifstream in(path.c_str());
+  SkimCheckpoint ck;
+  while (in >> ck.run >> ck.entries >> ck.fileSize >> ck.fileMTime) ckpts.push_back(ck);
+  return ckpts;
+}
+
+void writeCheckpoints(string path, const vector<SkimCheckpoint>& ckpts, bool append)
+{
+  ofstream out(path.c_str(), append ? ios::app : ios::trunc);
+  for (auto& ck : ckpts)
+    out << ck.run << " " << ck.entries << " " << ck.fileSize << " " << ck.fileMTime << "\n";
+}
+
+// The gatified file's size and modification time stand in for a checksum:
+// hashing every multi-GB input on every restart would cost about as much as skimming it.
+SkimCheckpoint makeCheckpoint(int run, Long64_t entries)
+{
+  SkimCheckpoint ck = {run, entries, -1, -1};
+  GATDataSet ds;
+  string gatPath = ds.GetPathToRun(run, GATDataSet::kGatified);
+  struct stat info;
+  if (stat(gatPath.c_str(), &info) == 0) {
+    ck.fileSize = (long long)info.st_size;
+    ck.fileMTime = (long long)info.st_mtime;
+  }
+  return ck;
+}
+
+bool sameInput(const SkimCheckpoint& a, const SkimCheckpoint& b)
+{
+  return (a.fileSize >= 0 && a.fileSize == b.fileSize && a.fileMTime == b.fileMTime);
+}
+
+// Number of skimTree entries in a skim file, or -1 if it can't be read.
+Long64_t skimEntries(string path)
+{
+  TFile *f = TFile::Open(path.c_str(), "READ");
+  TTree *t = (f == NULL) ? NULL : (TTree*)f->Get("skimTree");
+  Long64_t n = (t == NULL) ? -1 : t->GetEntries();
+  if (f != NULL) f->Close();
+  return n;
+}
+
+// ==========================================================================
+// -j: each worker's c0Channels only has the cryostat-0 channels from its own block (and primer run).
+// The parent puts the channels seen in the earlier blocks back in front, in the order a serial
+// skim would have found them.  Each worker leaves its final list in <part>.c0 for this.
+
+// c0 with any new channels from 'more' appended
+vector<int> addC0(vector<int> c0, const vector<int>& more)
+{
+  for (auto ch : more)
+    if (find(c0.begin(), c0.end(), ch) == c0.end()) c0.push_back(ch);
+  return c0;
+}
+
+void writeC0List(string path, const vector<int>& c0)
+{
+  ofstream out(path.c_str());
+  for (auto ch : c0) out << ch << "\n";
+}
+
+vector<int> readC0List(string path)
+{
+  vector<int> c0;
+  ifstream in(path.c_str());
+  int ch;
+  while (in >> ch) c0.push_back(ch);
+  return c0;
+}
+
+// Copy every skimTree entry of 'in' to 'out', with 'before' added to the front of c0Channels.
+// If 'out' is NULL, it's cloned from 'in' into the current directory.
+Long64_t copyC0Entries(TTree *in, TTree *&out, const vector<int>& before)
+{
+  vector<int> c0, *c0In = NULL, *c0Out = &c0;
+  if (out == NULL) out = in->CloneTree(0);
+  else in->CopyAddresses(out);
+  in->SetBranchAddress("c0Channels", &c0In);
+  out->SetBranchAddress("c0Channels", &c0Out);
+  Long64_t n = in->GetEntries();
+  for (Long64_t i = 0; i < n; i++) {
+    in->GetEntry(i);
+    c0 = addC0(before, *c0In);
+    out->Fill();
+  }
+  in->CopyAddresses(out, true); // undo, 'in' is deleted when its file closes
+  delete c0In;
+  return n;
+}
+
+// copyC0Entries for one run shard (-j -s), rewritten in place.
+bool rewriteC0(string shard, const vector<int>& before)
+{
+  if (access(shard.c_str(), F_OK) != 0) return true; // the run had no entries
+  TFile *fIn = TFile::Open(shard.c_str(), "READ");
+  TTree *in = (fIn == NULL) ? NULL : (TTree*)fIn->Get("skimTree");
+  if (in == NULL) {
+    cout << "Error: can't read skimTree from " << shard << endl;
+    return false;
+  }
+  TTree *pulserIn = (TTree*)fIn->Get("pulserTree");
+  string tmpPath = shard + ".tmp";
+  TFile *fNew = TFile::Open(tmpPath.c_str(), "recreate");
+  TTree *out = NULL;
+  copyC0Entries(in, out, before);
+  out->Write("", TObject::kOverwrite);
+  if (pulserIn != NULL) pulserIn->CloneTree(-1, "fast")->Write("", TObject::kOverwrite);
+  fNew->Close();
+  fIn->Close();
+  return (rename(tmpPath.c_str(), shard.c_str()) == 0);
+}
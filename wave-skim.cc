@@ -9,33 +9,229 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
-#include <stack>
 #include <array>
+#include <unordered_set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sys/resource.h>
 #include "TFile.h"
 #include "TROOT.h"
 #include "TChain.h"
 #include "TEntryList.h"
+#include "TTreeFormula.h"
+#include "TSystem.h"
 #include "TTreeReader.h"
 #include "TTreeReaderArray.h"
 #include "GATDataSet.hh"
+#include "MGTEvent.hh"
 #include "MGTWaveform.hh"
 #include "MJTMSWaveform.hh"
 #include "MJTRun.hh"
 #include "MGWFNonLinearityCorrector.hh"
 #include "MJTGretina4DigitizerData.hh"
 #include "MJTypes.hh"
+#include "DataSetInfo.hh"
 
 using namespace std;
 
-void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc);
-void TCutSkimmer(string theCut, int dsNum);
+void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc, int nThreads=1, bool compact=false);
+void BenchmarkWaveRead(string objFile, string compactFile);
+Long64_t CopySelected(TTree *inTree, TTree *outTree, string theCut, function<void()> onSelect=NULL);
+void TCutSkimmer(string theCut, int dsNum, int nThreads=1);
 void diagnostic();
 void LoadNLCParameters(int ddID, int run, const MGVDigitizerData* dd, bool useTwoPass=true);
+void LoadNLCMap(MGWFNonLinearityCorrectionMap*& nlcMap, string fileName, string downFileName="");
+string NLCMapKey(string fileName);
+void BuildNLCDatabase(string dbPath);
+vector<string> FindFiles(string dir, string ext);
 
 // stuff for NLC.  made 'em global because fk it.
 map<int, MGWFNonLinearityCorrectionMap*> NLCMaps;
 map<int, MGWFNonLinearityCorrectionMap*> NLCMaps2;
 string NLCMapDir = "/project/projectdirs/majorana/data/production/NLCDB";
+string NLCDBPath = NLCMapDir + "/NLCDB.root"; // all maps in NLCMapDir, packed by BuildNLCDatabase
+TFile* NLCDB = NULL;
+
+// One NLC corrector per digitizer ID, built on first use with its maps and time constant.
+// Each thread keeps its own pool, and the maps are loaded beforehand by LoadNLCParameters.
+struct NLCCorrectorPool
+{
+  map<int, MGWFNonLinearityCorrector*> correctors;
+
+  MGWFNonLinearityCorrector* Get(int ddID, MGWFNonLinearityCorrectionMap* map1, MGWFNonLinearityCorrectionMap* map2)
+  {
+    auto it = correctors.find(ddID);
+    if (it != correctors.end()) return it->second;
+    MGWFNonLinearityCorrector* nlc = new MGWFNonLinearityCorrector();
+    nlc->SetNLCCourseFineMaps(map1, map2);
+    nlc->SetTimeConstant_samples(190); // 1.9 us time constant for Radford time-lagged method
+    correctors[ddID] = nlc;
+    return nlc;
+  }
+
+  ~NLCCorrectorPool() {
+    for (auto& c : correctors) delete c.second;
+  }
+};
+
+// Queue between the stages of the waveform pipeline.
+// Push blocks while it's full, Pop blocks until there's an item or the queue is closed.
+template <class T>
+struct BoundedQueue
+{
+  size_t capacity;
+  bool closed = false;
+  deque<T> items;
+  mutex mtx;
+  condition_variable notFull, notEmpty;
+
+  BoundedQueue(size_t cap) : capacity(cap) {}
+
+  void Push(T item) {
+    unique_lock<mutex> lock(mtx);
+    notFull.wait(lock, [&]{ return items.size() < capacity; });
+    items.push_back(item);
+    notEmpty.notify_one();
+  }
+
+  bool Pop(T& item) {
+    unique_lock<mutex> lock(mtx);
+    notEmpty.wait(lock, [&]{ return !items.empty() || closed; });
+    if (items.empty()) return false;
+    item = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void Close() {
+    lock_guard<mutex> lock(mtx);
+    closed = true;
+    notEmpty.notify_all();
+  }
+};
+
+// One cut tree entry in the waveform pipeline.  The waveform objects are kept between uses.
+struct WaveJob
+{
+  Long64_t entry = 0;
+  bool isMS = false;
+  size_t nWF = 0;                   // passing hits in this entry
+  vector<MGTWaveform*> reg, aux;    // built waveforms (downsampled and fully sampled if multisampling)
+  vector<MGTWaveform*> out;         // finished waveforms, in hit order
+  MJTMSWaveform ms;                 // scratch for combining reg and aux (multisampling)
+  vector<int> ddID;
+  vector<MGWFNonLinearityCorrectionMap*> nlcMap1, nlcMap2;
+  CompactWaves packed;              // finished waveforms, compact output mode
+
+  size_t Add() {
+    if (nWF == reg.size()) {
+      reg.push_back(new MGTWaveform);
+      aux.push_back(new MGTWaveform);
+      out.push_back(new MGTWaveform);
+      ddID.push_back(0);
+      nlcMap1.push_back(NULL);
+      nlcMap2.push_back(NULL);
+    }
+    return nWF++;
+  }
+
+  ~WaveJob() {
+    for (size_t k = 0; k < reg.size(); k++) { delete reg[k]; delete aux[k]; delete out[k]; }
+  }
+};
+
+
+// Forward-only join of the cut tree with one run's built and gatified trees.
+// Each run's files are opened once, only the waveform branches we use are read,
+// and the read cache only prefetches baskets holding the selected entries.
+struct BuiltRunCursor
+{
+  int run = -1;
+  bool isMS = false;
+  TFile *bFile = NULL, *gFile = NULL;
+  TTree *built = NULL, *gat = NULL;
+  TEntryList *bList = NULL, *gList = NULL;
+  MGTEvent *event = NULL;
+  vector<double> *channel = NULL;
+
+  bool Open(int r, const vector<Long64_t>& entries, bool nlc)
+  {
+    Close();
+    run = r;
+    GATDataSet ds;
+    TDirectory* tdir = gROOT->CurrentDirectory();
+    bFile = TFile::Open(ds.GetPathToRun(run,GATDataSet::kBuilt).c_str());
+    gFile = TFile::Open(ds.GetPathToRun(run,GATDataSet::kGatified).c_str());
+    if (bFile != NULL) built = (TTree*)bFile->Get("MGTree");
+    if (gFile != NULL) gat = (TTree*)gFile->Get("mjdTree");
+    if (built == NULL || gat == NULL) {
+      cout << "Error: couldn't open the built and gatified data for run " << run << endl;
+      gROOT->cd(tdir->GetPath());
+      return false;
+    }
+
+    // detect multisampling
+    MJTRun* runInfo = (MJTRun*)bFile->Get("run");
+    isMS = runInfo->GetUseMultisampling();
+
+    // only read the branches we need
+    built->SetBranchStatus("*",0);
+    built->SetBranchStatus("fWaveforms*",1);
+    if (isMS) built->SetBranchStatus("fAuxWaveforms*",1);
+    if (nlc) built->SetBranchStatus("fDigitizerData*",1);
+    built->SetBranchAddress("event",&event);
+    gat->SetBranchStatus("*",0);
+    gat->SetBranchStatus("channel",1);
+    gat->SetBranchAddress("channel",&channel);
+
+    // Entries are read by number with GetEntry, so the entry lists only steer the cache.
+    bList = new TEntryList("bList","selected entries");
+    gList = new TEntryList("gList","selected entries");
+    for (auto e : entries) { bList->Enter(e); gList->Enter(e); }
+    built->SetEntryList(bList);
+    gat->SetEntryList(gList);
+    for (TTree *t : {built, gat}) {
+      t->SetCacheSize(30000000);
+      if (!entries.empty()) t->SetCacheEntryRange(entries.front(), entries.back()+1);
+    }
+    built->AddBranchToCache("fWaveforms",true);
+    if (isMS) built->AddBranchToCache("fAuxWaveforms",true);
+    if (nlc) built->AddBranchToCache("fDigitizerData",true);
+    built->StopCacheLearningPhase();
+    gat->AddBranchToCache("channel",true);
+    gat->StopCacheLearningPhase();
+
+    gROOT->cd(tdir->GetPath());
+    return true;
+  }
+
+  bool GetEntry(Long64_t iEvent) {
+    return (built->GetEntry(iEvent) > 0 && gat->GetEntry(iEvent) > 0);
+  }
+
+  void Close()
+  {
+    if (built != NULL) built->SetEntryList(NULL);
+    if (gat != NULL) gat->SetEntryList(NULL);
+    delete bFile; // closes the file and deletes the trees
+    delete gFile;
+    delete bList;
+    delete gList;
+    delete event;
+    delete channel;
+    bFile = gFile = NULL;
+    built = gat = NULL;
+    bList = gList = NULL;
+    event = NULL;
+    channel = NULL;
+  }
+};
 
 int main(int argc, char** argv)
 {
@@ -47,12 +243,18 @@ int main(int argc, char** argv)
         << "       [-f [dsNum] [runNum] : specify DS and run num]\n"
         << "       [-p [inPath] [outPath]: file locations]\n"
         << "       [-c : use calibration TCut]\n"
-        << "       [-n : do the Radford 2-pass NLC correction]\n";
+        << "       [-n : do the Radford 2-pass NLC correction]\n"
+        << "       [-d [dbFile] : NLC map database (default: NLCDB.root in the NLC map dir)]\n"
+        << "       [-b : pack the NLC map files into the database]\n"
+        << "       [-t [nThreads] : MS/NLC worker threads, or files skimmed at once with -s (default 1)]\n"
+        << "       [-w : write compact waveform columns (CompactWaves) instead of MGTWaveforms]\n"
+        << "       [-k [objFile] [compactFile] : compare waveform read speed of the two formats]\n";
    return 1;
  }
  string inPath=".", outPath=".";
- int dsNum=-1, subNum=0, run=0;
- bool sw=0, tcs=0, fil=0, cal=0, nlc=0;
+ int dsNum=-1, subNum=0, run=0, nThreads=1;
+ bool sw=0, tcs=0, fil=0, cal=0, nlc=0, bld=0, cmp=0;
+ string objFile, compactFile;
  vector<string> opt(argv, argv+argc);
  for (size_t i = 0; i < opt.size(); i++) {
    if (opt[i] == "-s") { sw=0; tcs=1; }
@@ -64,6 +266,35 @@ int main(int argc, char** argv)
      cout << "Performing Pass-2 Nonlinearity Correction ...\n";
      nlc=1;
    }
+   if (opt[i] == "-d") { NLCDBPath = opt[i+1]; }
+   if (opt[i] == "-b") { bld=1; }
+   if (opt[i] == "-t") { nThreads = max(1, stoi(opt[i+1])); }
+   if (opt[i] == "-w") { cmp=1; }
+   if (opt[i] == "-k") { objFile = opt[i+1]; compactFile = opt[i+2]; }
+ }
+ if (cmp && nlc) {
+   cout << "Compact waveforms store integer samples, so they can't be used with the NLC correction (-n).\n";
+   return 1;
+ }
+
+ // Compare read speed of the two waveform formats and quit
+ if (objFile != "") {
+   BenchmarkWaveRead(objFile, compactFile);
+   return 0;
+ }
+
+ // Build the NLC map database and quit
+ if (bld) {
+   BuildNLCDatabase(NLCDBPath);
+   return 0;
+ }
+
+ // Serve the NLC maps from the database if we have one
+ if (nlc && !gSystem->AccessPathName(NLCDBPath.c_str())) {
+   TDirectory* tdir = gROOT->CurrentDirectory();
+   NLCDB = TFile::Open(NLCDBPath.c_str());
+   gROOT->cd(tdir->GetPath());
+   if (NLCDB != NULL) cout << "Using NLC map database " << NLCDBPath << endl;
  }
 
  // DS0-5 standard cut
@@ -93,12 +324,12 @@ int main(int argc, char** argv)
  // Go running
  // diagnostic();
  cout << "Scanning DS-" << dsNum << endl;
- if (tcs) TCutSkimmer(theCut, dsNum);
- if (!tcs && sw) SkimWaveforms(theCut, inFile, outFile, nlc);
+ if (tcs) TCutSkimmer(theCut, dsNum, nThreads);
+ if (!tcs && sw) SkimWaveforms(theCut, inFile, outFile, nlc, nThreads, cmp);
 }
 
 
-void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc)
+void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc, int nThreads, bool compact)
 {
  // Take an input skim file, copy it with a waveform branch appended.
  // NOTE: The copied vectors are NOT resized to contain only entries passing cuts.
@@ -107,159 +338,240 @@ void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc)
  TChain *skimTree = new TChain("skimTree");
  skimTree->Add(inFile.c_str());
  cout << "Found " << skimTree->GetEntries() << " input skim entries.\n";
- size_t n = skimTree->Draw(">>elist",theCut.c_str(), "entrylist");
- cout << "Draw successful.  Found " << n << " events passing cuts.\n";
- if (n == 0) {
+ int run=0, iEvent=0;
+ vector<double> *channel=0;
+ skimTree->SetBranchAddress("run",&run);
+ skimTree->SetBranchAddress("iEvent",&iEvent);
+ skimTree->SetBranchAddress("channel",&channel);
+ TFile *output = new TFile(outFile.c_str(),"RECREATE");
+ TTree *cutTree = skimTree->CloneTree(0);
+
+ // Copy the entries passing theCut in one pass over the input.
+ // Also note each one's run, iEvent and passing channels, for adding the waveforms.
+ // The passing channels of all entries are kept in one flat array (entry i: chanList[chanStart[i]..chanStart[i+1]) ).
+ // Also collect the selected built/gatified entries in each run (the cut tree is in run, iEvent order)
+ vector<int> entryRun, entryEvent, chanList;
+ vector<size_t> chanStart(1, 0);
+ int chanMax = 0;
+ map<int, vector<Long64_t>> runEntries;
+ Long64_t n = CopySelected(skimTree, cutTree, theCut, [&]() {
+   entryRun.push_back(run);
+   entryEvent.push_back(iEvent);
+   for (auto ch : *channel) {
+     chanList.push_back((int)ch);
+     chanMax = max(chanMax, (int)ch);
+   }
+   chanStart.push_back(chanList.size());
+   runEntries[run].push_back(iEvent);
+ });
+ cout << "Selection successful.  Found " << n << " events passing cuts.\n";
+ if (n <= 0) {
    cout << "No events found passing cuts.  Exiting ...\n";
+   output->Close();
+   gSystem->Unlink(outFile.c_str());
    return;
  }
- TEntryList *elist = (TEntryList*)gDirectory->Get("elist");
- skimTree->SetEntryList(elist);
- TFile *output = new TFile(outFile.c_str(),"RECREATE");
- cout << "Attempting tree copy ... \n";
- TTree *cutTree = skimTree->CopyTree("");
- cout << "Tree copy successful.\n";
  cutTree->Write("",TObject::kOverwrite);
  TNamed thisCut("theCut",theCut);	// save the cut used into the file.
  thisCut.Write();
  cout << Form("Using this cut:  \n%s  \nWrote %lli entries to the cut tree.\n",theCut.c_str(),cutTree->GetEntries());
+ for (auto& re : runEntries) sort(re.second.begin(), re.second.end());
 
  // Add waveforms to the cut tree, keeping only one run in memory at a time
- int run=0, iEvent=0;
- vector<double> *channel=0;
- cutTree->SetBranchAddress("run",&run);
- cutTree->SetBranchAddress("iEvent",&iEvent);
- cutTree->SetBranchAddress("channel",&channel);
-
+ Long64_t nEnt = cutTree->GetEntries();
  vector<MGTWaveform*> *waveVector=0;
- stack<MGTWaveform*> usedPointers;
- TBranch *waveBranch = cutTree->Branch("MGTWaveforms","vector<MGTWaveform*>",&waveVector,32000,0);
-
- GATDataSet *ds = new GATDataSet();
- string runPath = "";
- TChain *built = new TChain("MGTree");
- TChain *gat = new TChain("mjdTree");
- TTreeReader bReader(built);
- TTreeReader gReader(gat);
- TTreeReaderValue<TClonesArray> dd(bReader,"fDigitizerData");
- TTreeReaderValue<TClonesArray> wfBranch(bReader,"fWaveforms");
- TTreeReaderValue<TClonesArray> wfAuxBranch(bReader,"fAuxWaveforms");
- TTreeReaderArray<double> wfChan(gReader,"channel");
- int prevRun=0;
- bool isMS=0, printMS=0;
- cout << "Adding waveforms to the cut tree ...\n";
- for (int i = 0; i < cutTree->GetEntries(); i++)
- {
-   cutTree->GetEntry(i);
-   if (run != prevRun) {
-     built->Reset();
-     gat->Reset();
-     runPath = ds->GetPathToRun(run,GATDataSet::kBuilt);
-     built->Add(runPath.c_str());
-     bReader.SetTree(built);
-
-     // detect multisampling
-     TDirectory* tdir = gROOT->CurrentDirectory();
-     TFile bFile(runPath.c_str());
-     MJTRun* runInfo = (MJTRun*)bFile.Get("run");
-     isMS = runInfo->GetUseMultisampling();
-     if (printMS==0 && isMS==1) {
-       cout << "Multisampling detected.\n";
-       printMS=1;
-     }
-     gROOT->cd(tdir->GetPath());
+ TBranch *waveBranch = NULL;
+ CompactWaves outWaves;
+ if (compact) outWaves.Branch(cutTree);
+ else waveBranch = cutTree->Branch("MGTWaveforms","vector<MGTWaveform*>",&waveVector,32000,0);
 
-     runPath = ds->GetPathToRun(run,GATDataSet::kGatified);
-     gat->Add(runPath.c_str());
-     gReader.SetTree(gat);
-   }
-   bReader.SetEntry(iEvent);
-   gReader.SetEntry(iEvent);
-   waveVector->resize(0);
-   int nWF = (*wfBranch).GetEntries();
-
-   // Figure out which hits made it into the skim file (some are cut by data cleaning)
-   // This preserves the 1-1 matching between the skim vectors and the new MGTWaveform vector
-   int numPass = cutTree->Draw("channel","","GOFF",1,i);
-   double *channelList = cutTree->GetV1();
-   vector<double> chanVec;
-   for (int j = 0; j < numPass; j++) chanVec.push_back(channelList[j]);
-
-   // Fill the waveform branch
-   for (int iWF = 0; iWF < nWF; iWF++)
+ // Three stages: read built entries -> MS/NLC workers -> ordered writer.
+ // A fixed set of jobs cycles through the queues.  Each job keeps its waveform objects (and their
+ // sample buffers) between events, including the scratch MJTMSWaveform for multisampled hits.
+ ROOT::EnableThreadSafety();
+ size_t nJobs = 4*nThreads + 4;
+ vector<WaveJob*> jobs;
+ BoundedQueue<WaveJob*> freeJobs(nJobs), work(nJobs), done(nJobs);
+ for (size_t j = 0; j < nJobs; j++) {
+   jobs.push_back(new WaveJob);
+   freeJobs.Push(jobs.back());
+ }
+ atomic<bool> readErr(false), rounded(false);
+ atomic<int> activeWorkers(nThreads);
+ double readBusy=0, writeBusy=0;
+ vector<double> workBusy(nThreads,0);
+ auto now = [](){ return chrono::steady_clock::now(); };
+ auto secs = [](chrono::steady_clock::time_point t0, chrono::steady_clock::time_point t1) {
+   return chrono::duration<double>(t1-t0).count();
+ };
+ auto tStart = now();
+ cout << "Adding waveforms to the cut tree with " << nThreads << " worker thread(s) ...\n";
+
+ // Reader: copy the passing hits' waveforms out of the built data, in cut tree order.
+ // NLC maps are loaded here, so the global maps are only touched by this thread.
+ thread reader([&]() {
+   BuiltRunCursor cursor;
+   unordered_set<int> nlcLoaded;
+   vector<char> chanPass(chanMax+1, 0);
+   int prevRun=0;
+   bool printMS=0;
+   WaveJob* job;
+   for (Long64_t i = 0; i < nEnt; i++)
    {
-     if ( find(chanVec.begin(), chanVec.end(), wfChan[iWF]) != chanVec.end() )
-     {
-       // don't handle multisampling
-       // MGTWaveform *wave = dynamic_cast<MGTWaveform*>((*wfBranch).At(iWF));
-
-       // handle multisampling
-       MGTWaveform* wave = NULL;
-       if (!isMS) {
-         MGTWaveform* reg = dynamic_cast<MGTWaveform*>((*wfBranch).At(iWF));
-         reg->SetWFEncScheme(MGTWaveform::kDiffVarInt); // it should copy this over, but just in case ...
-         wave = reg;
+     freeJobs.Pop(job);
+     auto t0 = now();
+     int run = entryRun[i];
+     if (run != prevRun) {
+       if (!cursor.Open(run, runEntries[run], nlc)) { readErr = true; break; }
+       if (printMS==0 && cursor.isMS==1) {
+         cout << "Multisampling detected.\n";
+         printMS=1;
        }
-       else if (!nlc) {
-         MGTWaveform* reg = dynamic_cast<MGTWaveform*>((*wfBranch).At(iWF)); // downsampled wf
-         MGTWaveform* aux = dynamic_cast<MGTWaveform*>((*wfAuxBranch).At(iWF)); // fully sampled wf
-         MJTMSWaveform ms(reg,aux);
-         ms.SetWFEncScheme(MGTWaveform::kDiffVarInt);
-         wave = dynamic_cast<MGTWaveform*>(&ms);
+       prevRun = run;
+     }
+     cursor.GetEntry(entryEvent[i]);
+     MGTEvent *event = cursor.event;
+     vector<double> &wfChan = *(cursor.channel);
+
+     // Figure out which hits made it into the skim file (some are cut by data cleaning)
+     // This preserves the 1-1 matching between the skim vectors and the new MGTWaveform vector
+     for (size_t c = chanStart[i]; c < chanStart[i+1]; c++) chanPass[chanList[c]] = 1;
+
+     job->entry = i;
+     job->isMS = cursor.isMS;
+     job->nWF = 0;
+     int nWF = event->GetNWaveforms();
+     for (int iWF = 0; iWF < nWF; iWF++)
+     {
+       int chan = (int)wfChan[iWF];
+       if (chan < 0 || chan > chanMax || !chanPass[chan]) continue;
+       size_t k = job->Add();
+       *(job->reg[k]) = *(event->GetWaveform(iWF)); // downsampled wf if multisampling
+       if (job->isMS) *(job->aux[k]) = *(event->GetAuxWaveform(iWF)); // fully sampled wf
+       if (nlc) {
+         MGVDigitizerData* d = event->GetDigitizerData(iWF);
+         int ddID = d->GetID();
+         if (!nlcLoaded.count(ddID)) {
+           LoadNLCParameters(ddID, run, d); // Adds NLC maps for this detector if they don't exist already
+           nlcLoaded.insert(ddID);
+         }
+         job->ddID[k] = ddID;
+         job->nlcMap1[k] = NLCMaps[ddID];
+         job->nlcMap2[k] = NLCMaps2[ddID];
        }
+     }
+     for (size_t c = chanStart[i]; c < chanStart[i+1]; c++) chanPass[chanList[c]] = 0;
+     readBusy += secs(t0, now());
+     work.Push(job);
+   }
+   cursor.Close();
+   work.Close();
+ });
 
-       // do the 2-pass NLC correction from GAT-v01-06.  See below for a reference.
-       if (nlc)
+ // Workers: build the multisampled waveforms and do the 2-pass NLC correction from GAT-v01-06.
+ // The correctors keep scratch state, so each worker has its own.  See below for a reference.
+ vector<thread> workers;
+ for (int iThread = 0; iThread < nThreads; iThread++)
+   workers.push_back(thread([&, iThread]() {
+     NLCCorrectorPool nlcPool;
+     WaveJob* job;
+     while (work.Pop(job))
+     {
+       auto t0 = now();
+       for (size_t k = 0; k < job->nWF; k++)
        {
-         MGVDigitizerData* d = dynamic_cast<MGVDigitizerData*>((*dd).At(iWF));
-         int ddID = d->GetID();
-         LoadNLCParameters(ddID, run, d); // Adds NLC maps for this detector/run if they don't exist already
-
-         MGWFNonLinearityCorrector* nlc = new MGWFNonLinearityCorrector();
-         nlc->SetNLCCourseFineMaps(NLCMaps[ddID], NLCMaps2[ddID]);
-         nlc->SetTimeConstant_samples(190); // 1.9 us time constant for Radford time-lagged method
-
-         // In multisampled mode, we only can do the NLC on the fully sampled part of the WF.
-         if (isMS) {
-             MGTWaveform* reg = dynamic_cast<MGTWaveform*>((*wfBranch).At(iWF));  // downsampled wf
-             MGTWaveform* aux = dynamic_cast<MGTWaveform*>((*wfAuxBranch).At(iWF));  // fully sampled wf
-             nlc->TransformInPlace(*aux);
-             MJTMSWaveform ms(reg,aux);
-             ms.SetWFEncScheme(MGTWaveform::kDiffVarInt);
-             wave = dynamic_cast<MGTWaveform*>(&ms);
+         MGTWaveform* reg = job->reg[k];
+         MGWFNonLinearityCorrector* corr = NULL;
+         if (nlc) corr = nlcPool.Get(job->ddID[k], job->nlcMap1[k], job->nlcMap2[k]);
+         if (!job->isMS) {
+           reg->SetWFEncScheme(MGTWaveform::kDiffVarInt); // it should copy this over, but just in case ...
+           if (nlc) corr->TransformInPlace(*reg); // preferred method
+           swap(job->reg[k], job->out[k]);
          }
          else {
-           nlc->TransformInPlace(*wave); // preferred method
+           // In multisampled mode, we only can do the NLC on the fully sampled part of the WF.
+           MGTWaveform* aux = job->aux[k];
+           if (nlc) corr->TransformInPlace(*aux);
+           job->ms.SetWaveforms(reg,aux);
+           job->ms.SetWFEncScheme(MGTWaveform::kDiffVarInt);
+           *(job->out[k]) = job->ms;
          }
-         delete nlc;
        }
-
-       // use a stack, don't clone wf's (huge memory leak)
-       if(usedPointers.empty()) waveVector->push_back(new MGTWaveform);
-       else {
-         waveVector->push_back(usedPointers.top());
-         usedPointers.pop();
+       if (compact) {
+         job->packed.Clear();
+         job->packed.isMS = job->isMS;
+         for (size_t k = 0; k < job->nWF; k++) {
+           MGTWaveform* wf = job->out[k];
+           const vector<double>& wfData = wf->GetVectorData();
+           if (!job->packed.Add(wfData.data(), wfData.size(), wf->GetSamplingPeriod(), wf->GetTOffset()))
+             rounded = true;
+         }
        }
-       *(waveVector->back()) = *wave;
-       // cout << Form("   wave -> iWF %i  channel %.0f\n", iWF,wfChan[iWF]);
+       workBusy[iThread] += secs(t0, now());
+       done.Push(job);
      }
-   }
-   waveBranch->Fill();
+     if (--activeWorkers == 0) done.Close();
+   }));
 
-   // send any new pointers into usedPointers so they can be reused
-   for (MGTWaveform* waveptr : *waveVector) {
-     waveptr->Clear();
-     usedPointers.push(waveptr);
-   }
-   waveVector->clear();
+ // Writer: fill the waveform branch in cut tree order, holding back jobs that finish early.
+ // Only nJobs entries can be in flight, so the early ones wait in a ring indexed by entry % nJobs.
+ vector<WaveJob*> pending(nJobs, NULL);
+ Long64_t next = 0;
+ WaveJob* job;
+ while (done.Pop(job))
+ {
+   pending[job->entry % nJobs] = job;
+   while (pending[next % nJobs] != NULL)
+   {
+     auto t0 = now();
+     job = pending[next % nJobs];
+     pending[next % nJobs] = NULL;
+     if (compact) {
+       outWaves.Swap(job->packed);
+       outWaves.FillBranches();
+     }
+     else {
+       waveVector->assign(job->out.begin(), job->out.begin() + job->nWF);
+       waveBranch->Fill();
+       waveVector->clear();
+     }
 
-   // update progress and save
-   if (i%10000==0 && i!=0) {
-     cout << i << " saved, " << 100*i/(double)cutTree->GetEntries() << "% done.\n";
-     cutTree->Write("", TObject::kOverwrite);
+     // update progress and save
+     if (next%10000==0 && next!=0) {
+       cout << next << " saved, " << 100*next/(double)nEnt << "% done.\n";
+       cutTree->Write("", TObject::kOverwrite);
+     }
+     next++;
+     writeBusy += secs(t0, now());
+     freeJobs.Push(job);
    }
-   prevRun = run;
  }
+ reader.join();
+ for (auto& w : workers) w.join();
+ for (auto j : jobs) delete j;
+ for (auto& m : NLCMaps) delete m.second;
+ for (auto& m : NLCMaps2) delete m.second;
+ NLCMaps.clear();
+ NLCMaps2.clear();
+ if (readErr) {
+   // Don't leave a cut tree with only some of its waveforms behind
+   cout << "Error reading the built data.  Removing " << outFile << " ...\n";
+   output->Close();
+   gSystem->Unlink(outFile.c_str());
+   return;
+ }
+ if (rounded) cout << "Warning: some waveforms had non-integer samples, which were rounded in the compact output.\n";
+
+ // Report each stage's throughput.  The stage that's busy for most of the wall time is the bottleneck.
+ double wall = secs(tStart, now()), workSum = 0;
+ for (auto b : workBusy) workSum += b;
+ cout << Form("Processed %lli entries in %.1f s (%.1f evt/s).\n",nEnt,wall,wall > 0 ? nEnt/wall : 0.);
+ cout << Form("   read (I/O): busy %.1f s, %.1f evt/s\n",readBusy,readBusy > 0 ? nEnt/readBusy : 0.);
+ cout << Form("   MS/NLC    : busy %.1f s over %i thread(s), %.1f evt/s\n",workSum,nThreads,workSum > 0 ? nThreads*nEnt/workSum : 0.);
+ cout << Form("   write     : busy %.1f s, %.1f evt/s\n",writeBusy,writeBusy > 0 ? nEnt/writeBusy : 0.);
+ struct rusage usage;
+ getrusage(RUSAGE_SELF, &usage);
+ cout << Form("Peak RSS: %.1f MB\n",usage.ru_maxrss/1024.);
 
  // Save and quit
  cutTree->Write("",TObject::kOverwrite);
@@ -270,57 +582,173 @@ void SkimWaveforms(string theCut, string inFile, string outFile, bool nlc)
 }
 
 
-void TCutSkimmer(string theCut, int dsNum)
+Long64_t CopySelected(TTree *inTree, TTree *outTree, string theCut, function<void()> onSelect)
+{
+ // Fill outTree (a CloneTree(0) of inTree) with the entries passing theCut, in one pass.
+ // The cut is compiled once and only reads the branches it uses; the rest are only read for passing entries.
+ // Like Draw(">>elist"), an entry passes if any instance of the cut (e.g. any hit) is true.
+ // onSelect is called after each passing entry is read.  Returns the number passing, or -1 for a bad cut.
+ TTreeFormula *sel = new TTreeFormula("sel", theCut.c_str(), inTree);
+ if (sel->GetNdim() == 0) {
+   cout << "Error: couldn't compile the cut: " << theCut << endl;
+   delete sel;
+   return -1;
+ }
+ inTree->SetNotify(sel); // update the formula's leaves when a TChain changes files
+
+ Long64_t nEnt = inTree->GetEntries(), nPass = 0;
+ for (Long64_t i = 0; i < nEnt; i++)
+ {
+   if (inTree->LoadTree(i) < 0) break;
+   int nData = sel->GetNdata();
+   bool pass = false;
+   for (int j = 0; j < nData && !pass; j++) pass = (sel->EvalInstance(j) != 0);
+   if (!pass) continue;
+   inTree->GetEntry(i);
+   outTree->Fill();
+   if (onSelect) onSelect();
+   nPass++;
+ }
+ inTree->SetNotify(NULL);
+ delete sel;
+ return nPass;
+}
+
+
+void BenchmarkWaveRead(string objFile, string compactFile)
+{
+ // Read every waveform from a standard wave skim (MGTWaveforms) and a compact one (wave-skim -w),
+ // and report the read speed of each.  The sample sums should agree if both came from the same skim.
+ auto now = [](){ return chrono::steady_clock::now(); };
+
+ TChain *objTree = new TChain("skimTree");
+ objTree->Add(objFile.c_str());
+ objTree->SetBranchStatus("*",0);
+ objTree->SetBranchStatus("MGTWaveforms*",1);
+ vector<MGTWaveform*> *waves=0;
+ objTree->SetBranchAddress("MGTWaveforms",&waves);
+ Long64_t nObj = objTree->GetEntries(), nObjSamp = 0;
+ double objSum = 0;
+ auto t0 = now();
+ for (Long64_t i = 0; i < nObj; i++) {
+   objTree->GetEntry(i);
+   for (auto wf : *waves) {
+     const vector<double>& wfData = wf->GetVectorData();
+     for (auto x : wfData) objSum += x;
+     nObjSamp += wfData.size();
+   }
+ }
+ double objTime = chrono::duration<double>(now()-t0).count();
+
+ TChain *cmpTree = new TChain("skimTree");
+ cmpTree->Add(compactFile.c_str());
+ CompactWaves cw;
+ if (!cw.SetBranches(cmpTree)) return;
+ Long64_t nCmp = cmpTree->GetEntries(), nCmpSamp = 0;
+ double cmpSum = 0;
+ t0 = now();
+ for (Long64_t i = 0; i < nCmp; i++) {
+   cw.GetEntry(i);
+   for (size_t k = 0; k < cw.Size(); k++) {
+     CompactWaves::Span wf = cw.Get(k);
+     for (auto x : wf) cmpSum += x;
+     nCmpSamp += wf.size;
+   }
+ }
+ double cmpTime = chrono::duration<double>(now()-t0).count();
+
+ cout << Form("MGTWaveforms : %lli entries, %lli samples in %.2f s (%.1f evt/s)  sum %.0f\n",
+   nObj,nObjSamp,objTime,objTime > 0 ? nObj/objTime : 0.,objSum);
+ cout << Form("CompactWaves : %lli entries, %lli samples in %.2f s (%.1f evt/s)  sum %.0f\n",
+   nCmp,nCmpSamp,cmpTime,cmpTime > 0 ? nCmp/cmpTime : 0.,cmpSum);
+ if (cmpTime > 0) cout << Form("Speedup: %.1fx\n",objTime/cmpTime);
+}
+
+
+void TCutSkimmer(string theCut, int dsNum, int nThreads)
 {
  // There is a simpler version of this routine in data-cleaning.cc
  // if you don't want all the file I/O at the top here.
  // Cut down a skim file by saving only entries that pass the cut
  // into a new file.  (Very useful for low-threshold skim files).
+ // The files are independent, so nThreads of them are skimmed at once, each with its own TFile.
 
  cout << "Skimming data set " << dsNum << " using this cut: " << theCut << "\n\n";
 
  // Find all files matching the expression
- string command = Form("ls ~/project/cal-skim/skimDS%i*",dsNum);
- array<char, 128> buffer;
- vector<string> files;
- string str;
- shared_ptr<FILE> pipe(popen(command.c_str(), "r"), pclose);
- if (!pipe) throw runtime_error("popen() failed!");
- while (!feof(pipe.get())) {
-   if (fgets(buffer.data(), 128, pipe.get()) != NULL) {
-     str = buffer.data();
-     str.erase(remove(str.begin(), str.end(), '\n'), str.end());  // strip newline
-     files.push_back(str);
-   }
+ vector<string> files = GlobFiles(Form("~/project/cal-skim/skimDS%i*",dsNum));
+ if (files.empty()) {
+   cout << "No skim files found for DS-" << dsNum << endl;
+   return;
  }
 
  // Apply theCut to each file and make a new one
- for (auto file : files)
+ ROOT::EnableThreadSafety();
+ mutex coutMutex;
+ atomic<size_t> nextFile(0), nDone(0);
+ atomic<Long64_t> nIn(0), nKept(0);
+ atomic<bool> badCut(false);
+ auto tStart = chrono::steady_clock::now();
+ auto skimFiles = [&]()
  {
-   cout << "input: " << file << endl;
-
-   // Get the run range and create an output file
-   string range = file.substr(file.find(Form("DS%i",dsNum))+2);
-   string ext = "_cgw.root";
-   string::size_type i = range.find(ext);
-   if (i != string::npos) range.erase(i, ext.length());
-   string outFile = "~/project/cal-skim-basic/skim-basicDS" + range + ".root";
-   cout << "output: " << outFile << endl;
-
-   // Skim the input file with theCut
-   TChain *skim = new TChain("skimTree");
-   skim->Add(file.c_str());
-   skim->Draw(">>entList",theCut.c_str(),"entrylist GOFF");
-   TEntryList *entList = (TEntryList*)gDirectory->Get("entList");
-   skim->SetEntryList(entList);
-   TFile *f2 = new TFile(outFile.c_str(),"recreate");
-   TTree *small = skim->CopyTree("");
-   small->Write();
-   cout << "Wrote " << small->GetEntries() << " entries.\n";
-   TNamed thisCut("cutUsedHere",theCut);	// save the cut used into the file.
-   thisCut.Write();
-   f2->Close();
+   for (size_t iFile = nextFile++; iFile < files.size(); iFile = nextFile++)
+   {
+     string file = files[iFile];
+     auto t0 = chrono::steady_clock::now();
+
+     // Get the run range and create an output file
+     string range = file.substr(file.find(Form("DS%i",dsNum))+2);
+     string ext = "_cgw.root";
+     string::size_type i = range.find(ext);
+     if (i != string::npos) range.erase(i, ext.length());
+     string outFile = "~/project/cal-skim-basic/skim-basicDS" + range + ".root";
+
+     // Skim the input file with theCut
+     TChain *skim = new TChain("skimTree");
+     skim->Add(file.c_str());
+     TFile *f2 = new TFile(outFile.c_str(),"recreate");
+     TTree *small = skim->CloneTree(0);
+     if (CopySelected(skim, small, theCut) < 0) {
+       // The cut doesn't compile against this file.  Don't leave an empty output, and stop handing out files.
+       badCut = true;
+       nextFile = files.size();
+       f2->Close();
+       delete f2;
+       delete skim;
+       TString outPath = outFile.c_str();
+       gSystem->ExpandPathName(outPath);
+       gSystem->Unlink(outPath);
+       lock_guard<mutex> lock(coutMutex);
+       cout << "Bad cut for " << file << ", removed " << outFile << endl;
+       break;
+     }
+     small->Write();
+     Long64_t in = skim->GetEntries(), kept = small->GetEntries();
+     TNamed thisCut("cutUsedHere",theCut);	// save the cut used into the file.
+     thisCut.Write();
+     f2->Close();
+     delete f2;
+     delete skim;
+
+     nIn += in;
+     nKept += kept;
+     double dt = chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+     lock_guard<mutex> lock(coutMutex);
+     cout << Form("[%zu/%zu] %s -> %s\n        kept %lli of %lli entries (%.1f s)\n",
+       (size_t)++nDone, files.size(), file.c_str(), outFile.c_str(), kept, in, dt);
+   }
+ };
+ vector<thread> workers;
+ for (int iThread = 0; iThread < nThreads; iThread++) workers.push_back(thread(skimFiles));
+ for (auto& w : workers) w.join();
+ if (badCut) {
+   cout << "Error: couldn't apply the cut.  Stopped after " << nDone << " of " << files.size() << " files.\n";
+   return;
  }
+
+ double wall = chrono::duration<double>(chrono::steady_clock::now()-tStart).count();
+ cout << Form("Skimmed %zu files with %i thread(s) in %.1f s: kept %lli of %lli entries (%.1f files/min, %.0f entries/s).\n",
+   files.size(), nThreads, wall, (Long64_t)nKept, (Long64_t)nIn, wall > 0 ? 60*files.size()/wall : 0., wall > 0 ? nIn/wall : 0.);
 }
 
 
@@ -449,14 +877,14 @@ void LoadNLCParameters(int ddID, int run, const MGVDigitizerData* dd, bool useTw
      char fileName1a[500];
      sprintf(fileName1a,"%s/Boards/%s/c%dslot%d/Crate%d_GRET%d_Ch%d_part1a.dat",
              NLCMapDir.c_str(), bsnString, crate, card, crate, card, channel);
-     map1->LoadFromCombinedFile(fileName1a);
+     LoadNLCMap(map1, fileName1a);
      NLCMaps[ddID] = map1;
 
      MGWFNonLinearityCorrectionMap* map2 = new MGWFNonLinearityCorrectionMap;
      char fileName2a[500];
      sprintf(fileName2a,"%s/Boards/%s/c%dslot%d/Crate%d_GRET%d_Ch%d_part2a.dat",
              NLCMapDir.c_str(), bsnString, crate, card, crate, card, channel);
-     map2->LoadFromCombinedFile(fileName2a);
+     LoadNLCMap(map2, fileName2a);
      NLCMaps2[ddID] = map2;
    }
 
@@ -494,12 +922,12 @@ void LoadNLCParameters(int ddID, int run, const MGVDigitizerData* dd, bool useTw
        sprintf(upFileName,"%s/Crate%d_GRET%d_Ch%d_up1.dat", path.c_str(), crate, card, channel);
        char downFileName[500];
        sprintf(downFileName,"%s/Crate%d_GRET%d_Ch%d_up0.dat", path.c_str(), crate, card, channel);
-       map1->LoadFromUpDownFiles(upFileName, downFileName);
+       LoadNLCMap(map1, upFileName, downFileName);
      }
      else if(crate == 2) {
        char combFileName[500];
        sprintf(combFileName,"%s/Crate%d_GRET%d_Ch%d_comb.dat", path.c_str(), crate, card, channel);
-       map1->LoadFromCombinedFile(combFileName);
+       LoadNLCMap(map1, combFileName);
      }
      else {
        cout << "GATNonLinearityCorrector::LoadParameters("
@@ -510,3 +938,95 @@ void LoadNLCParameters(int ddID, int run, const MGVDigitizerData* dd, bool useTw
    }
  }
 }
+
+
+void LoadNLCMap(MGWFNonLinearityCorrectionMap*& nlcMap, string fileName, string downFileName)
+{
+ // Take the map from the NLC database if it's open, otherwise parse the text file(s).
+ if (NLCDB != NULL) {
+   MGWFNonLinearityCorrectionMap* dbMap = NULL;
+   NLCDB->GetObject(NLCMapKey(fileName).c_str(), dbMap);
+   if (dbMap != NULL) {
+     delete nlcMap;
+     nlcMap = dbMap;
+     return;
+   }
+   cout << "Warning: " << fileName << " isn't in the NLC database, reading the file.\n";
+ }
+ if (downFileName == "") nlcMap->LoadFromCombinedFile(fileName.c_str());
+ else nlcMap->LoadFromUpDownFiles(fileName.c_str(), downFileName.c_str());
+}
+
+
+string NLCMapKey(string fileName)
+{
+ // Database key of an NLC map file: its path under NLCMapDir, with '/' -> '.'
+ // e.g. Boards.019h.c1slot5.Crate1_GRET5_Ch0_part1a.dat  or  Run11339.Crate2_GRET9_Ch1_comb.dat
+ string pre = NLCMapDir + "/";
+ if (fileName.compare(0, pre.size(), pre) == 0) fileName.erase(0, pre.size());
+ replace(fileName.begin(), fileName.end(), '/', '.');
+ return fileName;
+}
+
+
+vector<string> FindFiles(string dir, string ext)
+{
+ // Every file under dir (searched recursively, not following linked directories) ending in ext.
+ // Sorted, like GlobFiles.
+ vector<string> files, dirs = {dir};
+ while (!dirs.empty())
+ {
+   string d = dirs.back();
+   dirs.pop_back();
+   void *dirp = gSystem->OpenDirectory(d.c_str());
+   if (dirp == NULL) continue;
+   while (const char *entry = gSystem->GetDirEntry(dirp))
+   {
+     string name = entry;
+     if (name == "." || name == "..") continue;
+     string path = d + "/" + name;
+     FileStat_t st;
+     if (gSystem->GetPathInfo(path.c_str(), st) != 0) continue;
+     if (R_ISDIR(st.fMode)) {
+       if (!st.fIsLink) dirs.push_back(path);
+     }
+     else if (name.size() >= ext.size() && name.compare(name.size()-ext.size(), ext.size(), ext) == 0)
+       files.push_back(path);
+   }
+   gSystem->FreeDirectory(dirp);
+ }
+ sort(files.begin(), files.end());
+ return files;
+}
+
+
+void BuildNLCDatabase(string dbPath)
+{
+ // Parse every NLC map under NLCMapDir once, and store them all in one ROOT file.
+ // Two-pass (part1a/part2a) and combined maps are keyed by their file, up/down pairs by the up file.
+ cout << "Packing NLC maps from " << NLCMapDir << " into " << dbPath << endl;
+
+ vector<string> files = FindFiles(NLCMapDir, ".dat");
+
+ auto endsWith = [](const string& s, const string& ext) {
+   return s.size() >= ext.size() && s.compare(s.size()-ext.size(), ext.size(), ext) == 0;
+ };
+
+ TFile *db = new TFile(dbPath.c_str(),"RECREATE");
+ int nMaps = 0;
+ for (auto file : files)
+ {
+   MGWFNonLinearityCorrectionMap nlcMap;
+   if (endsWith(file,"_part1a.dat") || endsWith(file,"_part2a.dat") || endsWith(file,"_comb.dat"))
+     nlcMap.LoadFromCombinedFile(file.c_str());
+   else if (endsWith(file,"_up1.dat")) {
+     string down = file.substr(0, file.size()-8) + "_up0.dat";
+     nlcMap.LoadFromUpDownFiles(file.c_str(), down.c_str());
+   }
+   else continue;
+   db->WriteObject(&nlcMap, NLCMapKey(file).c_str());
+   nMaps++;
+ }
+ db->Close();
+ cout << "Wrote " << nMaps << " NLC maps.\n";
+}